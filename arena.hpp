@@ -0,0 +1,245 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Thrown when an allocation would take the arena past its cap
+class MemoryBudgetExceeded : public std::runtime_error {
+public:
+    explicit MemoryBudgetExceeded(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Process-wide allocator for the engines' long-lived and hot-path memory,
+// with a hard cap and peak tracking. Requests up to MAX_POOLED bytes are
+// rounded up to a power-of-two size class and carved from CHUNK_BYTES
+// chunks; freed blocks go on their class's free list and are reused, never
+// returned to malloc. Larger requests are malloc'ed one by one. Chunks and
+// large blocks both count against the cap, so an engine that checks
+// can_grow() first can spill or shed caches before it would fail.
+//
+// The cap is STORAGE_MEMORY_CAP bytes from the environment (a K or M suffix
+// is allowed) or DEFAULT_CAP.
+class Arena {
+public:
+    static const size_t DEFAULT_CAP = 3 * 1024 * 1024;
+
+private:
+    static const size_t CHUNK_BYTES = 64 * 1024;
+    static const size_t MIN_CLASS_BYTES = 16;
+    static const size_t MAX_POOLED = 2048;
+    static const int CLASS_COUNT = 8;  // 16, 32, ..., 2048
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Chunk {
+        Chunk* next;
+    };
+
+    size_t cap;
+    size_t reserved;  // chunks and large blocks
+    size_t peak;
+    size_t in_use;    // bytes handed out, rounded up to their class
+    FreeBlock* free_lists[CLASS_COUNT];
+    Chunk* chunks;
+    char* bump;       // unused tail of the newest chunk
+    char* bump_end;
+
+public:
+    explicit Arena(size_t cap_bytes)
+        : cap(cap_bytes), reserved(0), peak(0), in_use(0), free_lists(), chunks(nullptr), bump(nullptr),
+          bump_end(nullptr) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        while (chunks != nullptr) {
+            Chunk* next = chunks->next;
+            free(chunks);
+            chunks = next;
+        }
+    }
+
+    static Arena& global() {
+        static Arena instance(cap_from_env());
+        return instance;
+    }
+
+    void* allocate(size_t n) {
+        if (n > MAX_POOLED) {
+            charge(n);
+            void* p = malloc(n);
+            if (p == nullptr) {
+                reserved -= n;
+                throw std::bad_alloc();
+            }
+            in_use += n;
+            return p;
+        }
+
+        int c = size_class(n);
+        size_t bytes = MIN_CLASS_BYTES << c;
+        in_use += bytes;
+        if (free_lists[c] != nullptr) {
+            FreeBlock* block = free_lists[c];
+            free_lists[c] = block->next;
+            return block;
+        }
+        if (static_cast<size_t>(bump_end - bump) < bytes) {
+            new_chunk();
+        }
+        void* p = bump;
+        bump += bytes;
+        return p;
+    }
+
+    void deallocate(void* p, size_t n) {
+        if (p == nullptr) {
+            return;
+        }
+        if (n > MAX_POOLED) {
+            free(p);
+            reserved -= n;
+            in_use -= n;
+            return;
+        }
+        int c = size_class(n);
+        in_use -= MIN_CLASS_BYTES << c;
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = free_lists[c];
+        free_lists[c] = block;
+    }
+
+    // Whether n more bytes could be allocated without passing the cap
+    bool can_allocate(size_t n) const {
+        return reserved + n <= cap;
+    }
+
+    // Whether another chunk fits under the cap with spare bytes left over;
+    // engines use this as the signal to spill or drop caches
+    bool can_grow(size_t spare = 0) const {
+        return can_allocate(CHUNK_BYTES + spare);
+    }
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    size_t used() const {
+        return in_use;
+    }
+
+    size_t reserved_bytes() const {
+        return reserved;
+    }
+
+    size_t peak_bytes() const {
+        return peak;
+    }
+
+private:
+    static size_t cap_from_env() {
+        const char* text = getenv("STORAGE_MEMORY_CAP");
+        if (text == nullptr || *text == '\0') {
+            return DEFAULT_CAP;
+        }
+        char* end;
+        size_t value = strtoull(text, &end, 10);
+        if (*end == 'K' || *end == 'k') value <<= 10;
+        if (*end == 'M' || *end == 'm') value <<= 20;
+        return value > 0 ? value : DEFAULT_CAP;
+    }
+
+    static int size_class(size_t n) {
+        int c = 0;
+        while ((MIN_CLASS_BYTES << c) < n) c++;
+        return c;
+    }
+
+    void charge(size_t n) {
+        if (reserved + n > cap) {
+            throw MemoryBudgetExceeded("memory cap of " + std::to_string(cap) + " bytes exceeded: " +
+                                       std::to_string(reserved) + " reserved, " + std::to_string(n) +
+                                       " more requested");
+        }
+        reserved += n;
+        if (reserved > peak) peak = reserved;
+    }
+
+    void new_chunk() {
+        // The rest of the current chunk is too small for this class; hand
+        // it out to the free lists of smaller ones
+        for (int c = CLASS_COUNT - 1; c >= 0; c--) {
+            size_t bytes = MIN_CLASS_BYTES << c;
+            while (static_cast<size_t>(bump_end - bump) >= bytes) {
+                FreeBlock* block = reinterpret_cast<FreeBlock*>(bump);
+                block->next = free_lists[c];
+                free_lists[c] = block;
+                bump += bytes;
+            }
+        }
+
+        charge(CHUNK_BYTES);
+        Chunk* chunk = static_cast<Chunk*>(malloc(CHUNK_BYTES));
+        if (chunk == nullptr) {
+            reserved -= CHUNK_BYTES;
+            throw std::bad_alloc();
+        }
+        chunk->next = chunks;
+        chunks = chunk;
+        bump = reinterpret_cast<char*>(chunk) + MIN_CLASS_BYTES;  // Past the header, still 16-byte aligned
+        bump_end = reinterpret_cast<char*>(chunk) + CHUNK_BYTES;
+    }
+};
+
+// Standard allocator over Arena::global(), for containers on the hot path
+template <class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(Arena::global().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        Arena::global().deallocate(p, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+struct ArenaStringHash {
+    size_t operator()(const ArenaString& s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+#endif  // ARENA_HPP
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""
+Workload generator for the file storage engines.
+
+Every workload is a list of runs. Each run is one program invocation: an
+input file in the problem's format plus the expected output, computed
+against an in-memory model. The runs of a workload share one working
+directory, so runs after the first exercise persistence.
+
+Usage:
+    python3 gen_workload.py --kind zipf --ops 100000 --out /tmp/wl
+    python3 gen_workload.py --list
+
+This writes <out>/<kind>.<run>.in and <out>/<kind>.<run>.ans.
+"""
+
+import argparse
+import bisect
+import itertools
+import os
+import random
+import string
+
+MAX_VALUE = 2**31 - 1
+
+
+class Model:
+    """Reference semantics: key -> set of values."""
+
+    def __init__(self):
+        self.data = {}
+        self.entries = 0
+
+    def insert(self, key, value):
+        values = self.data.setdefault(key, set())
+        if value not in values:
+            values.add(value)
+            self.entries += 1
+
+    def delete(self, key, value):
+        values = self.data.get(key)
+        if values and value in values:
+            values.remove(value)
+            self.entries -= 1
+            if not values:
+                del self.data[key]
+
+    def find(self, key):
+        values = self.data.get(key)
+        return " ".join(map(str, sorted(values))) if values else "null"
+
+
+def random_key(rng, min_len=4, max_len=24):
+    alphabet = string.ascii_letters + string.digits
+    return "".join(rng.choice(alphabet) for _ in range(rng.randint(min_len, max_len)))
+
+
+def zipf_picker(rng, items, skew):
+    """Return a function that picks items[i] with weight 1 / (i + 1)^skew."""
+    cumulative = list(itertools.accumulate(1.0 / (i + 1) ** skew for i in range(len(items))))
+    total = cumulative[-1]
+    return lambda: items[bisect.bisect_left(cumulative, rng.random() * total)]
+
+
+class Builder:
+    """Collects the commands of one run and their expected output."""
+
+    def __init__(self, model, max_entries=100000):
+        self.model = model
+        self.max_entries = max_entries
+        self.lines = []
+        self.answers = []
+
+    def insert(self, key, value):
+        # The problem never inserts a pair that is already stored
+        if self.model.entries >= self.max_entries or value in self.model.data.get(key, ()):
+            return
+        self.model.insert(key, value)
+        self.lines.append(f"insert {key} {value}")
+
+    def delete(self, key, value):
+        self.model.delete(key, value)
+        self.lines.append(f"delete {key} {value}")
+
+    def find(self, key):
+        self.answers.append(self.model.find(key))
+        self.lines.append(f"find {key}")
+
+    def existing_value(self, rng, key):
+        values = self.model.data.get(key)
+        return rng.choice(sorted(values)) if values else rng.randint(0, MAX_VALUE)
+
+    def result(self):
+        text = f"{len(self.lines)}\n" + "\n".join(self.lines) + "\n"
+        return text, "".join(answer + "\n" for answer in self.answers)
+
+
+def mixed_run(rng, model, ops, pick_key, insert_share, delete_share, value_range=MAX_VALUE):
+    """insert/delete/find mix over keys chosen by pick_key."""
+    run = Builder(model)
+    for _ in range(ops):
+        key = pick_key()
+        roll = rng.random()
+        if roll < insert_share:
+            run.insert(key, rng.randint(0, value_range))
+        elif roll < insert_share + delete_share:
+            run.delete(key, run.existing_value(rng, key) if rng.random() < 0.7 else rng.randint(0, value_range))
+        else:
+            run.find(key)
+    return run.result()
+
+
+def uniform(rng, ops, keys):
+    pool = [random_key(rng) for _ in range(keys)]
+    return [mixed_run(rng, Model(), ops, lambda: rng.choice(pool), 0.5, 0.2)]
+
+
+def zipf(rng, ops, keys):
+    pool = [random_key(rng) for _ in range(keys)]
+    pick = zipf_picker(rng, pool, 1.1)
+    return [mixed_run(rng, Model(), ops, pick, 0.5, 0.2)]
+
+
+def delete_heavy(rng, ops, keys):
+    pool = [random_key(rng) for _ in range(keys)]
+    model = Model()
+    return [mixed_run(rng, model, ops, lambda: rng.choice(pool), 0.35, 0.5, value_range=1000)]
+
+
+def many_values(rng, ops, keys):
+    """A handful of keys holding thousands of values each."""
+    pool = [random_key(rng) for _ in range(max(1, keys // 1000))]
+    return [mixed_run(rng, Model(), ops, lambda: rng.choice(pool), 0.7, 0.05)]
+
+
+def all_miss(rng, ops, keys):
+    """Fill the store, then query only keys that were never inserted."""
+    model = Model()
+    run = Builder(model)
+    pool = [random_key(rng) for _ in range(keys)]
+    for _ in range(ops // 2):
+        run.insert(rng.choice(pool), rng.randint(0, MAX_VALUE))
+    for _ in range(ops - ops // 2):
+        run.find(random_key(rng, 25, 40))  # longer than any stored key
+    return [run.result()]
+
+
+def persistence(rng, ops, keys, runs=4):
+    """Several runs over one database directory, each continuing the last."""
+    pool = [random_key(rng) for _ in range(keys)]
+    model = Model()
+    per_run = max(1, ops // runs)
+    return [mixed_run(rng, model, per_run, lambda: rng.choice(pool), 0.5, 0.2) for _ in range(runs)]
+
+
+def reinsert(rng, ops, keys, runs=2):
+    """Pairs deleted and inserted again, in the same run and in a later one."""
+    pool = [random_key(rng) for _ in range(max(1, keys // 100))]
+    model = Model()
+    deleted = []
+    result = []
+    for _ in range(runs):
+        run = Builder(model)
+        for _ in range(max(1, ops // runs)):
+            key = rng.choice(pool)
+            roll = rng.random()
+            if roll < 0.4:
+                run.insert(key, rng.randint(0, 1000))
+            elif roll < 0.6:
+                value = run.existing_value(rng, key)
+                run.delete(key, value)
+                if rng.random() < 0.3:
+                    run.insert(key, value)
+                    run.find(key)
+                else:
+                    deleted.append((key, value))
+            elif roll < 0.8 and deleted:
+                run.insert(*deleted.pop(rng.randrange(len(deleted))))
+            else:
+                run.find(key)
+        result.append(run.result())
+    return result
+
+
+KINDS = {
+    "uniform": uniform,
+    "zipf": zipf,
+    "delete_heavy": delete_heavy,
+    "many_values": many_values,
+    "all_miss": all_miss,
+    "persistence": persistence,
+    "reinsert": reinsert,
+}
+
+
+def generate(kind, ops, keys, seed):
+    """Return [(input_text, expected_output), ...] for workload kind."""
+    return KINDS[kind](random.Random(seed), ops, keys)
+
+
+def write_workload(kind, runs, out_dir):
+    """Write the runs of a workload; returns the input file paths in order."""
+    os.makedirs(out_dir, exist_ok=True)
+    paths = []
+    for i, (text, answer) in enumerate(runs, 1):
+        base = os.path.join(out_dir, f"{kind}.{i}")
+        with open(base + ".in", "w") as f:
+            f.write(text)
+        with open(base + ".ans", "w") as f:
+            f.write(answer)
+        paths.append(base + ".in")
+    return paths
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate file storage workloads")
+    parser.add_argument("--kind", choices=sorted(KINDS), action="append",
+                        help="workload to generate (repeatable; default: all)")
+    parser.add_argument("--ops", type=int, default=100000, help="commands per workload")
+    parser.add_argument("--keys", type=int, default=20000, help="distinct keys to draw from")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--out", default="workloads", help="output directory")
+    parser.add_argument("--list", action="store_true", help="list workload kinds and exit")
+    args = parser.parse_args()
+
+    if args.list:
+        print("\n".join(sorted(KINDS)))
+        return
+
+    for kind in args.kind or sorted(KINDS):
+        paths = write_workload(kind, generate(kind, args.ops, args.keys, args.seed), args.out)
+        print(f"{kind}: {len(paths)} run(s) in {args.out}")
+
+
+if __name__ == "__main__":
+    main()
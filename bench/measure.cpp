@@ -0,0 +1,67 @@
+// Runs one command and reports what it cost:
+//     measure <input> <output> <program> [args...]
+// runs program with stdin from input and stdout to output, then prints
+//     exit <status> maxrss_kib <n> rchar <n> wchar <n>
+// to stderr. The numbers come from wait4() and /proc/self/io after the
+// program is reaped, which by then include its counters.
+//
+// run_bench.py launches benchmarks through this rather than straight from
+// Python because a process's peak RSS carries over from the process it was
+// forked from; forked from this small binary, the program's own peak shows.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <input> <output> <program> [args...]\n", argv[0]);
+        return 2;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        int in = open(argv[1], O_RDONLY);
+        int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0) {
+            perror("redirect");
+            _exit(127);
+        }
+        close(in);
+        close(out);
+        execv(argv[3], argv + 3);
+        perror("exec");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return 2;
+    }
+
+    long long rchar = 0, wchar = 0;
+    if (FILE* io = fopen("/proc/self/io", "r")) {
+        char field[64];
+        long long value;
+        while (fscanf(io, "%63[^:]: %lld\n", field, &value) == 2) {
+            if (strcmp(field, "rchar") == 0) rchar = value;
+            if (strcmp(field, "wchar") == 0) wchar = value;
+        }
+        fclose(io);
+    }
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    fprintf(stderr, "exit %d maxrss_kib %ld rchar %lld wchar %lld\n", code, usage.ru_maxrss, rchar, wchar);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""
+Benchmark every storage variant on every generated workload.
+
+Every executable target of the CMake project is a variant: "code", one
+"code_<backend>" per FileStorage backend and one per standalone main_*.cpp.
+Each is built in Release mode, then run on each workload in a fresh
+working directory (every run of a multi-run workload in the same one). Per
+workload and variant it reports:
+    time     wall time over all runs, in seconds
+    rss      peak resident set size of any run, in KiB
+    read     bytes read by the program, including stdin
+    written  bytes written by the program, excluding its stdout
+    files    files left in the working directory
+    check    whether the output matched the model's
+Programs are launched through measure.cpp. Byte counts come from the
+rchar/wchar counters of /proc/<pid>/io, so they include reads served from
+the page cache; a timed-out run is reported as such and ends the workload.
+
+Usage:
+    python3 bench/run_bench.py                        # everything
+    python3 bench/run_bench.py --variant code_lsm --kind zipf --ops 20000
+"""
+
+import argparse
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_workload  # noqa: E402
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def configure(build_dir):
+    """Configure the project in build_dir; returns its executable targets."""
+    subprocess.run(["cmake", "-S", REPO, "-B", build_dir, "-DCMAKE_BUILD_TYPE=Release"],
+                   stdout=subprocess.DEVNULL, check=True)
+    listing = subprocess.run(["cmake", "--build", build_dir, "--target", "help"],
+                             stdout=subprocess.PIPE, check=True, text=True).stdout
+    targets = [line[4:].split()[0] for line in listing.splitlines() if line.startswith("... ")]
+    return sorted(t for t in targets if t == "code" or t.startswith("code_"))
+
+
+def build(build_dir, target):
+    """Build one target; returns its binary, or None if it does not build."""
+    result = subprocess.run(["cmake", "--build", build_dir, "--target", target, "-j", str(os.cpu_count())],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return os.path.join(build_dir, target) if result.returncode == 0 else None
+
+
+def build_measure(build_dir):
+    binary = os.path.join(build_dir, "measure")
+    source = os.path.join(os.path.dirname(os.path.abspath(__file__)), "measure.cpp")
+    subprocess.run(["g++", "-O2", "-o", binary, source], check=True)
+    return binary
+
+
+def run_once(measure, binary, input_path, work_dir, timeout):
+    """Run binary on one input in work_dir.
+
+    Returns (output, seconds, counters); counters holds exit, maxrss_kib,
+    rchar and wchar as printed by measure. Raises subprocess.TimeoutExpired.
+    """
+    output_path = os.path.join(work_dir, ".bench_output")
+    start = time.monotonic()
+    proc = subprocess.Popen([measure, input_path, output_path, binary],
+                            cwd=work_dir, stderr=subprocess.PIPE, start_new_session=True)
+    try:
+        _, err = proc.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        os.killpg(proc.pid, signal.SIGKILL)
+        proc.communicate()
+        raise
+    seconds = time.monotonic() - start
+
+    fields = err.decode().split()
+    counters = {name: int(value) for name, value in zip(fields[-8::2], fields[-7::2])}
+    with open(output_path) as f:
+        output = f.read()
+    os.remove(output_path)
+    return output, seconds, counters
+
+
+def bench_variant(measure, binary, inputs, timeout):
+    """Run the inputs of one workload in order in a fresh directory."""
+    work_dir = tempfile.mkdtemp(prefix="bench_")
+    row = {"time": 0.0, "rss": 0, "read": 0, "written": 0, "files": 0, "check": "ok"}
+    try:
+        for input_path in inputs:
+            try:
+                output, seconds, counters = run_once(measure, binary, input_path, work_dir, timeout)
+            except subprocess.TimeoutExpired:
+                row["check"] = "timeout"
+                break
+            row["time"] += seconds
+            row["rss"] = max(row["rss"], counters["maxrss_kib"])
+            row["read"] += counters["rchar"]
+            row["written"] += counters["wchar"] - len(output)
+            with open(os.path.splitext(input_path)[0] + ".ans") as f:
+                if counters["exit"] != 0:
+                    row["check"] = f"exit {counters['exit']}"
+                elif output != f.read() and row["check"] == "ok":
+                    row["check"] = "WRONG"
+        row["files"] = len(os.listdir(work_dir))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark storage variants")
+    parser.add_argument("--variant", action="append", help="variant to run (default: all)")
+    parser.add_argument("--kind", action="append", choices=sorted(gen_workload.KINDS),
+                        help="workload to run (default: all)")
+    parser.add_argument("--ops", type=int, default=100000)
+    parser.add_argument("--keys", type=int, default=20000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=60, help="seconds per run")
+    args = parser.parse_args()
+
+    kinds = args.kind or sorted(gen_workload.KINDS)
+
+    scratch = tempfile.mkdtemp(prefix="bench_build_")
+    try:
+        build_dir = os.path.join(scratch, "build")
+        chosen = args.variant or configure(build_dir)
+        if args.variant:
+            configure(build_dir)
+        measure = build_measure(scratch)
+        binaries = {name: build(build_dir, name) for name in chosen}
+
+        header = f"{'workload':<14}{'variant':<16}{'time':>9}{'rss':>9}{'read':>13}{'written':>13}{'files':>7}  check"
+        print(header)
+        print("-" * len(header))
+        for kind in kinds:
+            runs = gen_workload.generate(kind, args.ops, args.keys, args.seed)
+            inputs = gen_workload.write_workload(kind, runs, os.path.join(scratch, "workloads"))
+            for name in chosen:
+                if binaries[name] is None:
+                    print(f"{kind:<14}{name:<16}{'':>51}  build failed", flush=True)
+                    continue
+                row = bench_variant(measure, binaries[name], inputs, args.timeout)
+                print(f"{kind:<14}{name:<16}{row['time']:>9.3f}{row['rss']:>9}"
+                      f"{row['read']:>13}{row['written']:>13}{row['files']:>7}  {row['check']}",
+                      flush=True)
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,646 @@
+#ifndef BLOCK_LIST_HPP
+#define BLOCK_LIST_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "bloom_filter.hpp"
+#include "buffer_pool.hpp"
+#include "storage_engine.hpp"
+
+// Block linked list: (key, value) pairs are kept sorted across a chain of
+// fixed-size blocks in one file. Only the head of every block (id, size and
+// first record) is kept in memory, so a lookup reads just the block(s) that
+// can hold the key.
+//
+// Records inside a block are front-coded against the previous key:
+//   [shared prefix length: 1][suffix length: 1][suffix bytes][value: 4]
+// Restart records store their full key (shared = 0); their offsets are kept
+// in an array at the end of the block, so a lookup binary searches the
+// restarts and decodes one interval. Inserts and deletes edit the encoded
+// bytes in place and re-encode only the following record; a block is
+// rebuilt with a restart every RESTART_INTERVAL records when an insert
+// doesn't fit or would grow an interval past twice that, and on merges.
+//
+// Every block ends with a Bloom filter over its keys, sized for
+// bits_per_key bits per record (plus headroom for in-place inserts) when
+// the block is rebuilt. Filters are cached next to the block heads up to
+// FILTER_BUDGET bytes, so a find for a missing key usually reads no block.
+// Deletes leave their bits set; the next rebuild clears them.
+//
+// Every block header starts with the format's magic and version, checked
+// as the chain is loaded, so a file of another format is refused.
+class BlockList {
+private:
+    static const int BLOCK_BYTES = 4096;
+    static const uint32_t MAGIC = 0x424c4b31;  // "BLK1"
+    static const uint32_t VERSION = 1;
+    static const int RESTART_INTERVAL = 16;
+    static const size_t POOL_BYTES = 128 * BLOCK_BYTES;
+    static const size_t FILTER_BUDGET = 128 * 1024;  // cached filter bytes
+    static const size_t FIND_CHUNK = 256;  // values per sink.put() in find_into()
+
+    struct BlockHeader {
+        uint32_t magic;
+        uint32_t version;
+        int count;          // records in the block
+        int next;           // id of the next block in the chain, -1 at the tail
+        int data_bytes;     // encoded records, growing up from the header
+        int restart_count;  // uint16 offsets, growing down from the filter
+        int filter_bytes;   // Bloom filter at the very end of the block
+        int filter_probes;
+    };
+
+    static const int PAYLOAD_BYTES = BLOCK_BYTES - sizeof(BlockHeader);
+    static const int MERGE_BYTES = PAYLOAD_BYTES / 2;
+
+    // Decoded record; keys compare bytewise, like strcmp
+    struct Record {
+        int value;
+        unsigned char len;
+        char key[64];
+
+        Record() : value(0), len(0) {}
+
+        Record(std::string_view k, int v) : value(v) {
+            len = k.size() < 64 ? k.size() : 64;
+            memcpy(key, k.data(), len);
+        }
+
+        bool same_key(const Record& other) const {
+            return len == other.len && memcmp(key, other.key, len) == 0;
+        }
+
+        bool operator<(const Record& other) const {
+            int cmp = memcmp(key, other.key, std::min(len, other.len));
+            if (cmp != 0) return cmp < 0;
+            if (len != other.len) return len < other.len;
+            return value < other.value;
+        }
+
+        bool operator==(const Record& other) const {
+            return value == other.value && same_key(other);
+        }
+    };
+
+    // Where a key sorts inside one block
+    struct Position {
+        int offset;       // of the first record >= target, data_bytes if none
+        int restart;      // restart interval the search started from
+        bool has_prev;
+        bool has_found;
+        Record prev;      // record before offset
+        Record found;     // record at offset
+        int found_bytes;  // encoded size of found
+    };
+
+    struct BlockHead {
+        int id;
+        int bytes;  // encoded size including restarts and filter
+        Record first;
+        int filter_probes;
+        ArenaVector<char> filter;  // copy of the block's filter, empty if not cached
+    };
+
+    using PageRef = BufferPool::PageRef;
+
+    BufferPool pool;
+    ArenaVector<BlockHead> heads;  // in chain order
+    ArenaVector<int> free_blocks;
+    int block_total;
+    int bits_per_key;              // 0 builds blocks without filters
+    size_t filter_memory;          // bytes in the cached filters
+    ArenaVector<Record> scratch;   // decoded block being rebuilt
+    ArenaVector<Record> spill;
+
+public:
+    BlockList(const std::string& fname, int bloom_bits_per_key = 10)
+        : pool(fname, BLOCK_BYTES, POOL_BYTES), block_total(pool.page_count()),
+          bits_per_key(bloom_bits_per_key), filter_memory(0) {
+        if (block_total == 0) {
+            // Fresh file: a single empty head block
+            PageRef page = pool.create(0);
+            encode(nullptr, 0, -1, page.as<char>());
+            block_total = 1;
+            heads.push_back({0, 0, Record(), 0, {}});
+            update_head(0, page);
+        } else {
+            load_heads();
+        }
+    }
+
+    void insert(std::string_view key, int value) {
+        Record target(key, value);
+        size_t i = locate(target);
+        PageRef page = pool.fetch(heads[i].id);
+        Position pos = seek(page.as<char>(), target);
+        if (pos.has_found && pos.found == target) {
+            return;  // Already exists
+        }
+
+        if (!insert_in_place(page.as<char>(), target, pos)) {
+            decode(page.as<char>(), scratch);
+            scratch.insert(std::lower_bound(scratch.begin(), scratch.end(), target), target);
+            store(i, page);
+            return;
+        }
+        update_head(i, page);
+        page.mark_dirty();
+    }
+
+    void remove(std::string_view key, int value) {
+        Record target(key, value);
+        size_t i = locate(target);
+        PageRef page = pool.fetch(heads[i].id);
+        Position pos = seek(page.as<char>(), target);
+        if (!pos.has_found || !(pos.found == target)) {
+            return;  // Entry may not exist
+        }
+
+        int next = header(page)->next;
+        remove_in_place(page.as<char>(), pos);
+        update_head(i, page);
+        page.mark_dirty();
+
+        if (i + 1 < heads.size() && heads[i].bytes + heads[i + 1].bytes <= MERGE_BYTES) {
+            merge_next(i, page);
+        } else if (header(page)->count == 0 && i > 0) {
+            unlink(i, next);
+        }
+    }
+
+    void flush() {
+        pool.flush();
+    }
+
+    std::vector<int> find(std::string_view key) {
+        ValueCollector values;
+        find_into(key, values);
+        return std::move(values.values);
+    }
+
+    // Pass the values of key to sink, ascending, one block's worth at a
+    // time as the chain is walked
+    void find_into(std::string_view key, ValueSink& sink) {
+        Record low(key, -1);  // Values are non-negative
+        uint64_t hash = BloomFilter::hash(low.key, low.len);
+        int values[FIND_CHUNK];
+
+        for (size_t i = locate(low); i < heads.size(); i++) {
+            if (!may_contain(heads[i], hash)) {
+                // A later block may still start with key; its filter says so
+                if (i + 1 >= heads.size() || !heads[i + 1].first.same_key(low)) {
+                    break;
+                }
+                continue;
+            }
+
+            PageRef page = pool.fetch(heads[i].id);
+            const char* data = page.as<char>() + sizeof(BlockHeader);
+            const char* end = data + header(page)->data_bytes;
+
+            Position pos = seek(page.as<char>(), low);
+            Record rec = pos.prev;
+            size_t n = 0;
+            for (const char* p = data + pos.offset; p < end; ) {
+                p = decode_record(p, rec);
+                if (!rec.same_key(low)) {
+                    break;
+                }
+                if (n == FIND_CHUNK) {
+                    sink.put(values, n);
+                    n = 0;
+                }
+                values[n++] = rec.value;
+            }
+            sink.put(values, n);
+
+            // Continue only if the next block still starts with this key
+            if (i + 1 >= heads.size() || !heads[i + 1].first.same_key(low)) {
+                break;
+            }
+        }
+    }
+
+private:
+    static BlockHeader* header(const PageRef& page) {
+        return page.as<BlockHeader>();
+    }
+
+    static char* filter(char* page) {
+        const BlockHeader* h = reinterpret_cast<const BlockHeader*>(page);
+        return page + BLOCK_BYTES - h->filter_bytes;
+    }
+
+    static uint16_t* restarts(char* page) {
+        const BlockHeader* h = reinterpret_cast<const BlockHeader*>(page);
+        return reinterpret_cast<uint16_t*>(filter(page)) - h->restart_count;
+    }
+
+    static int used_bytes(const BlockHeader* h) {
+        return h->data_bytes + h->restart_count * sizeof(uint16_t) + h->filter_bytes;
+    }
+
+    static bool may_contain(const BlockHead& head, uint64_t hash) {
+        if (head.filter.empty()) {
+            return true;  // No filter, or not cached: read the block
+        }
+        return BloomFilter::may_contain(head.filter.data(), head.filter.size(),
+                                        head.filter_probes, hash);
+    }
+
+    // Filter bytes for a block rebuilt with n records; a multiple of 8 so
+    // the restart array stays aligned
+    int filter_bytes_for(int n) const {
+        if (bits_per_key == 0) {
+            return 0;
+        }
+        return (BloomFilter::bytes_for(n + n / 4 + 8, bits_per_key) + 7) / 8 * 8;
+    }
+
+    // Whether the block's filter still meets bits_per_key with one more key
+    bool filter_has_room(const BlockHeader* h) const {
+        if (bits_per_key == 0) {
+            return h->filter_bytes == 0;
+        }
+        return (h->count + 1) * bits_per_key <= h->filter_bytes * 8;
+    }
+
+    static int shared_prefix(const Record& a, const Record& b) {
+        int n = std::min(a.len, b.len);
+        int i = 0;
+        while (i < n && a.key[i] == b.key[i]) i++;
+        return i;
+    }
+
+    static int record_bytes(const Record& rec, int shared) {
+        return 2 + rec.len - shared + sizeof(int);
+    }
+
+    // Decode one record at p into rec, which must hold the previous key
+    static const char* decode_record(const char* p, Record& rec) {
+        unsigned char shared = p[0];
+        unsigned char unshared = p[1];
+        memcpy(rec.key + shared, p + 2, unshared);
+        rec.len = shared + unshared;
+        memcpy(&rec.value, p + 2 + unshared, sizeof(int));
+        return p + 2 + unshared + sizeof(int);
+    }
+
+    static char* encode_record(char* p, const Record& rec, int shared) {
+        int unshared = rec.len - shared;
+        p[0] = shared;
+        p[1] = unshared;
+        memcpy(p + 2, rec.key + shared, unshared);
+        memcpy(p + 2 + unshared, &rec.value, sizeof(int));
+        return p + 2 + unshared + sizeof(int);
+    }
+
+    static void decode(char* page, ArenaVector<Record>& out) {
+        const BlockHeader* h = reinterpret_cast<const BlockHeader*>(page);
+        const char* p = page + sizeof(BlockHeader);
+        Record rec;
+        out.clear();
+        for (int i = 0; i < h->count; i++) {
+            p = decode_record(p, rec);
+            out.push_back(rec);
+        }
+    }
+
+    // Rebuild page from n sorted records; returns false if they don't fit
+    bool encode(const Record* recs, int n, int next, char* page) const {
+        int restart_total = (n + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+        int filter_total = filter_bytes_for(n);
+        char* begin = page + sizeof(BlockHeader);
+        char* bits = page + BLOCK_BYTES - filter_total;
+        uint16_t* offsets = reinterpret_cast<uint16_t*>(bits) - restart_total;
+        char* limit = reinterpret_cast<char*>(offsets);
+
+        char* p = begin;
+        for (int i = 0; i < n; i++) {
+            int shared = i % RESTART_INTERVAL == 0 ? 0 : shared_prefix(recs[i - 1], recs[i]);
+            if (p + record_bytes(recs[i], shared) > limit) {
+                return false;
+            }
+            if (i % RESTART_INTERVAL == 0) {
+                offsets[i / RESTART_INTERVAL] = p - begin;
+            }
+            p = encode_record(p, recs[i], shared);
+        }
+
+        BlockHeader* h = reinterpret_cast<BlockHeader*>(page);
+        h->magic = MAGIC;
+        h->version = VERSION;
+        h->count = n;
+        h->next = next;
+        h->data_bytes = p - begin;
+        h->restart_count = restart_total;
+        h->filter_bytes = filter_total;
+        h->filter_probes = BloomFilter::probes_for(bits_per_key);
+
+        memset(bits, 0, filter_total);
+        if (filter_total > 0) {
+            for (int i = 0; i < n; i++) {
+                BloomFilter::add(bits, filter_total, h->filter_probes,
+                                 BloomFilter::hash(recs[i].key, recs[i].len));
+            }
+        }
+        return true;
+    }
+
+    // Find where target sorts in page, decoding at most one interval
+    static Position seek(char* page, const Record& target) {
+        const BlockHeader* h = reinterpret_cast<const BlockHeader*>(page);
+        const char* data = page + sizeof(BlockHeader);
+        const char* end = data + h->data_bytes;
+        const uint16_t* offsets = restarts(page);
+
+        Position pos;
+        pos.restart = 0;
+        pos.has_prev = false;
+        pos.has_found = false;
+        pos.found_bytes = 0;
+
+        // Last restart whose full key sorts before target
+        int lo = 0, hi = h->restart_count;
+        while (hi - lo > 1) {
+            int mid = (lo + hi) / 2;
+            decode_record(data + offsets[mid], pos.found);
+            if (pos.found < target) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        pos.restart = lo;
+
+        const char* p = data + (h->restart_count > 0 ? offsets[lo] : 0);
+        while (p < end) {
+            const char* q = decode_record(p, pos.found);
+            if (!(pos.found < target)) {
+                pos.has_found = true;
+                pos.found_bytes = q - p;
+                break;
+            }
+            pos.prev = pos.found;
+            pos.has_prev = true;
+            p = q;
+        }
+        pos.offset = p - data;
+        return pos;
+    }
+
+    // Records from restart r up to the next restart or the end of the block
+    static int interval_length(char* page, int r) {
+        const BlockHeader* h = reinterpret_cast<const BlockHeader*>(page);
+        const char* data = page + sizeof(BlockHeader);
+        const uint16_t* offsets = restarts(page);
+        const char* p = data + offsets[r];
+        const char* end = data + (r + 1 < h->restart_count ? offsets[r + 1] : h->data_bytes);
+        int n = 0;
+        for (; p < end; n++) {
+            p += 2 + static_cast<unsigned char>(p[1]) + sizeof(int);
+        }
+        return n;
+    }
+
+    // Shift restart offsets at or after from by delta
+    static void shift_restarts(char* page, int from, int delta) {
+        BlockHeader* h = reinterpret_cast<BlockHeader*>(page);
+        uint16_t* offsets = restarts(page);
+        for (int r = h->restart_count - 1; r >= 0 && offsets[r] >= from; r--) {
+            offsets[r] += delta;
+        }
+    }
+
+    // Splice target into the encoded records; false if the block has to be
+    // rebuilt instead (no room, the interval grew too long, or the filter
+    // is full)
+    bool insert_in_place(char* page, const Record& target, const Position& pos) const {
+        BlockHeader* h = reinterpret_cast<BlockHeader*>(page);
+        if (!filter_has_room(h)) {
+            return false;
+        }
+        char* at = page + sizeof(BlockHeader) + pos.offset;
+
+        // The first record of a block has to be a restart
+        bool new_restart = !pos.has_prev;
+        int shared = pos.has_prev ? shared_prefix(pos.prev, target) : 0;
+        int new_bytes = record_bytes(target, shared);
+
+        // The successor now follows target, which shares at least as much
+        // with it as the old predecessor did
+        int succ_shared = 0;
+        int succ_bytes = pos.found_bytes;
+        if (pos.has_found && at[0] != 0) {
+            succ_shared = shared_prefix(target, pos.found);
+            succ_bytes = record_bytes(pos.found, succ_shared);
+        }
+
+        int delta = new_bytes + succ_bytes - pos.found_bytes;
+        int grow = delta + (new_restart ? sizeof(uint16_t) : 0);
+        if (used_bytes(h) + grow > PAYLOAD_BYTES) {
+            return false;
+        }
+        if (!new_restart && h->restart_count > 0 &&
+            interval_length(page, pos.restart) >= 2 * RESTART_INTERVAL) {
+            return false;
+        }
+
+        memmove(at + new_bytes + succ_bytes, at + pos.found_bytes,
+                h->data_bytes - pos.offset - pos.found_bytes);
+        char* p = encode_record(at, target, shared);
+        if (pos.has_found) {
+            encode_record(p, pos.found, succ_shared);
+        }
+
+        shift_restarts(page, pos.offset, delta);
+        if (new_restart) {
+            // The array grows down, so the old offsets keep their slots
+            h->restart_count++;
+            restarts(page)[0] = 0;
+        }
+        h->data_bytes += delta;
+        h->count++;
+        if (h->filter_bytes > 0) {
+            BloomFilter::add(filter(page), h->filter_bytes, h->filter_probes,
+                             BloomFilter::hash(target.key, target.len));
+        }
+        return true;
+    }
+
+    // Cut pos.found out of the encoded records. The successor is re-encoded
+    // against the removed record's predecessor, or as a full key if it takes
+    // over the removed restart; either way the block only shrinks.
+    static void remove_in_place(char* page, const Position& pos) {
+        BlockHeader* h = reinterpret_cast<BlockHeader*>(page);
+        char* data = page + sizeof(BlockHeader);
+        char* at = data + pos.offset;
+        uint16_t* offsets = restarts(page);
+        uint16_t* offsets_end = offsets + h->restart_count;
+        uint16_t* restart = std::lower_bound(offsets, offsets_end, pos.offset);
+        bool is_restart = restart != offsets_end && *restart == pos.offset;
+
+        char* succ_at = at + pos.found_bytes;
+        bool has_succ = succ_at < data + h->data_bytes &&
+                        !std::binary_search(offsets, offsets_end, pos.offset + pos.found_bytes);
+
+        Record succ = pos.found;
+        int succ_old = 0;
+        int succ_new = 0;
+        int succ_shared = 0;
+        if (has_succ && (is_restart || succ_at[0] != 0)) {
+            succ_old = decode_record(succ_at, succ) - succ_at;
+            succ_shared = is_restart ? 0 : shared_prefix(pos.prev, succ);
+            succ_new = record_bytes(succ, succ_shared);
+        }
+
+        int delta = succ_new - succ_old - pos.found_bytes;
+        memmove(at + succ_new, succ_at + succ_old,
+                h->data_bytes - (pos.offset + pos.found_bytes + succ_old));
+        if (succ_new > 0) {
+            encode_record(at, succ, succ_shared);
+        }
+
+        shift_restarts(page, pos.offset + 1, delta);
+        if (is_restart && !has_succ) {
+            // Nothing took over the removed restart; drop its offset
+            memmove(offsets + 1, offsets, (restart - offsets) * sizeof(uint16_t));
+            h->restart_count--;
+        }
+        h->data_bytes += delta;
+        h->count--;
+    }
+
+    // Index into heads of the block whose range covers target
+    size_t locate(const Record& target) const {
+        auto it = std::upper_bound(heads.begin() + 1, heads.end(), target,
+                                   [](const Record& t, const BlockHead& h) {
+                                       return t < h.first;
+                                   });
+        return (it - heads.begin()) - 1;
+    }
+
+    void update_head(size_t i, const PageRef& page) {
+        const BlockHeader* h = header(page);
+        heads[i].bytes = used_bytes(h);
+        if (h->count > 0) {
+            decode_record(page.as<char>() + sizeof(BlockHeader), heads[i].first);
+        }
+
+        // Cache the filter while the cached filters stay within budget and
+        // the arena has room to spare
+        filter_memory -= heads[i].filter.size();
+        if (filter_memory + h->filter_bytes <= FILTER_BUDGET && Arena::global().can_grow()) {
+            const char* bits = filter(page.as<char>());
+            heads[i].filter.assign(bits, bits + h->filter_bytes);
+            heads[i].filter_probes = h->filter_probes;
+        } else {
+            ArenaVector<char>().swap(heads[i].filter);
+        }
+        filter_memory += heads[i].filter.size();
+    }
+
+    void erase_head(size_t i) {
+        filter_memory -= heads[i].filter.size();
+        heads.erase(heads.begin() + i);
+    }
+
+    void load_heads() {
+        std::vector<bool> used(block_total, false);
+        for (int id = 0; id != -1;) {
+            if (id < 0 || id >= block_total || used[id]) {
+                throw std::runtime_error("broken block chain in " + pool.io().name());
+            }
+            PageRef page = pool.fetch(id);
+            if (header(page)->magic != MAGIC) {
+                throw std::runtime_error("bad block list file " + pool.io().name());
+            }
+            if (header(page)->version != VERSION) {
+                throw std::runtime_error(pool.io().name() + " has unsupported format version " +
+                                         std::to_string(header(page)->version));
+            }
+            used[id] = true;
+            heads.push_back({id, 0, Record(), 0, {}});
+            update_head(heads.size() - 1, page);
+            id = header(page)->next;
+        }
+        for (int id = 0; id < block_total; id++) {
+            if (!used[id]) {
+                free_blocks.push_back(id);
+            }
+        }
+    }
+
+    int allocate_block() {
+        if (!free_blocks.empty()) {
+            int id = free_blocks.back();
+            free_blocks.pop_back();
+            return id;
+        }
+        return block_total++;
+    }
+
+    // Rebuild heads[i] from scratch, splitting the block if it doesn't fit
+    void store(size_t i, PageRef& page) {
+        if (encode(scratch.data(), scratch.size(), header(page)->next, page.as<char>())) {
+            update_head(i, page);
+        } else {
+            split(i, page);
+        }
+        page.mark_dirty();
+    }
+
+    // scratch no longer fits in heads[i]: move its upper half to a new block
+    void split(size_t i, PageRef& page) {
+        int half = scratch.size() / 2;
+        int id = allocate_block();
+        PageRef right = pool.create(id);
+
+        encode(scratch.data() + half, scratch.size() - half, header(page)->next, right.as<char>());
+        encode(scratch.data(), half, id, page.as<char>());
+
+        update_head(i, page);
+        heads.insert(heads.begin() + i + 1, {id, 0, Record(), 0, {}});
+        update_head(i + 1, right);
+    }
+
+    // Append the block after heads[i] to it and drop that block from the chain
+    void merge_next(size_t i, PageRef& page) {
+        int next_id = heads[i + 1].id;
+        PageRef next = pool.fetch(next_id);
+        decode(page.as<char>(), scratch);
+        decode(next.as<char>(), spill);
+        scratch.insert(scratch.end(), spill.begin(), spill.end());
+        if (!encode(scratch.data(), scratch.size(), header(next)->next, page.as<char>())) {
+            // Front coding across the seam came out worse; keep both blocks
+            scratch.resize(scratch.size() - spill.size());
+            encode(scratch.data(), scratch.size(), next_id, page.as<char>());
+            update_head(i, page);
+            return;
+        }
+
+        update_head(i, page);
+        page.mark_dirty();
+        erase_head(i + 1);
+        free_blocks.push_back(next_id);
+    }
+
+    // Drop the now empty block heads[i] by pointing its predecessor past it
+    void unlink(size_t i, int next) {
+        PageRef prev = pool.fetch(heads[i - 1].id);
+        header(prev)->next = next;
+        prev.mark_dirty();
+
+        free_blocks.push_back(heads[i].id);
+        erase_head(i);
+    }
+};
+
+#endif  // BLOCK_LIST_HPP
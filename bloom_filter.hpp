@@ -0,0 +1,58 @@
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "entry.hpp"
+
+// Bloom filter over a caller-owned bit array, so the bits can live inside an
+// on-disk page and be copied to memory as-is. Keys are hashed once with the
+// 64-bit fingerprint hash; the probes are derived from it by double hashing.
+struct BloomFilter {
+    static uint64_t hash(const char* key, size_t len) {
+        return Entry::hash_key(key, len);
+    }
+
+    // Bytes of filter for keys keys at bits_per_key bits each
+    static size_t bytes_for(int keys, int bits_per_key) {
+        return (static_cast<size_t>(keys) * bits_per_key + 7) / 8;
+    }
+
+    // Number of probes minimizing false positives: bits_per_key * ln 2
+    static int probes_for(int bits_per_key) {
+        int probes = bits_per_key * 69 / 100;
+        if (probes < 1) probes = 1;
+        if (probes > 30) probes = 30;
+        return probes;
+    }
+
+    static void add(char* bits, size_t bytes, int probes, uint64_t h) {
+        size_t nbits = bytes * 8;
+        uint64_t delta = (h >> 33) | (h << 31);
+        for (int i = 0; i < probes; i++) {
+            size_t bit = h % nbits;
+            bits[bit / 8] |= 1 << (bit % 8);
+            h += delta;
+        }
+    }
+
+    // False means the key was never added; an empty filter admits everything
+    static bool may_contain(const char* bits, size_t bytes, int probes, uint64_t h) {
+        if (bytes == 0) {
+            return true;
+        }
+        size_t nbits = bytes * 8;
+        uint64_t delta = (h >> 33) | (h << 31);
+        for (int i = 0; i < probes; i++) {
+            size_t bit = h % nbits;
+            if ((bits[bit / 8] & (1 << (bit % 8))) == 0) {
+                return false;
+            }
+            h += delta;
+        }
+        return true;
+    }
+};
+
+#endif  // BLOOM_FILTER_HPP
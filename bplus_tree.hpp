@@ -0,0 +1,266 @@
+#ifndef BPLUS_TREE_HPP
+#define BPLUS_TREE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "entry.hpp"
+#include "storage_engine.hpp"
+
+// B+ tree over (key, value) pairs in fixed-size pages. Internal nodes hold
+// separator entries, leaves are linked left to right so find can walk every
+// value of a key in ascending order. Deletes only remove from the leaf; the
+// tree never shrinks, which keeps the height (and page reads per op) at
+// O(log n) of the largest size it ever reached. Page 0 is the meta page,
+// which starts with the format's magic and version.
+class BPlusTree {
+private:
+    static const int PAGE_SIZE = 4096;
+    static const uint32_t MAGIC = 0x42545231;  // "BTR1"
+    static const uint32_t VERSION = 1;
+    static const size_t POOL_BYTES = 64 * PAGE_SIZE;
+
+    struct NodeHeader {
+        int is_leaf;
+        int count;
+        int next;  // right sibling of a leaf, -1 at the end
+    };
+
+    static const int LEAF_CAPACITY = (PAGE_SIZE - sizeof(NodeHeader)) / sizeof(Entry);
+    static const int INTERNAL_CAPACITY =
+        (PAGE_SIZE - sizeof(NodeHeader) - sizeof(int)) / (sizeof(Entry) + sizeof(int));
+
+    struct LeafNode {
+        NodeHeader header;
+        Entry entries[LEAF_CAPACITY];
+    };
+
+    // keys[i] separates children[i] (< keys[i]) from children[i + 1] (>= keys[i])
+    struct InternalNode {
+        NodeHeader header;
+        int children[INTERNAL_CAPACITY + 1];
+        Entry keys[INTERNAL_CAPACITY];
+    };
+
+    struct MetaPage {
+        uint32_t magic;
+        uint32_t version;
+        int root;
+        int page_total;
+    };
+
+    struct Split {
+        Entry separator;
+        int right;
+    };
+
+    using PageRef = BufferPool::PageRef;
+
+    BufferPool pool;
+    MetaPage meta;
+
+public:
+    BPlusTree(const std::string& fname) : pool(fname, PAGE_SIZE, POOL_BYTES) {
+        if (pool.page_count() == 0) {
+            // Fresh file: meta page followed by an empty root leaf
+            meta = {MAGIC, VERSION, 0, 1};
+            meta.root = allocate_page();
+            PageRef root = pool.create(meta.root);
+            root.as<LeafNode>()->header = {1, 0, -1};
+            pool.create(0);  // Meta page, filled in by save_meta()
+            save_meta();
+        } else {
+            std::memcpy(&meta, pool.fetch(0).as<MetaPage>(), sizeof(MetaPage));
+            if (meta.magic != MAGIC) {
+                throw std::runtime_error("bad B+ tree file " + fname);
+            }
+            if (meta.version != VERSION) {
+                throw std::runtime_error(fname + " has unsupported format version " +
+                                         std::to_string(meta.version));
+            }
+        }
+    }
+
+    ~BPlusTree() {
+        flush();
+    }
+
+    void flush() {
+        save_meta();
+        pool.flush();
+    }
+
+    void insert(std::string_view key, int value) {
+        Entry target(key, value);
+        Split split;
+        if (!insert_into(meta.root, target, split)) {
+            return;
+        }
+
+        // Root split: grow the tree by one level
+        int new_root = allocate_page();
+        PageRef page = pool.create(new_root);
+        InternalNode* root = page.as<InternalNode>();
+        root->header = {0, 1, -1};
+        root->keys[0] = split.separator;
+        root->children[0] = meta.root;
+        root->children[1] = split.right;
+        meta.root = new_root;
+        save_meta();
+    }
+
+    void remove(std::string_view key, int value) {
+        Entry target(key, value);
+        PageRef page = pool.fetch(find_leaf(target));
+        LeafNode* leaf = page.as<LeafNode>();
+
+        Entry* end = leaf->entries + leaf->header.count;
+        Entry* pos = std::lower_bound(leaf->entries, end, target);
+        if (pos == end || !(*pos == target)) {
+            return;  // Entry may not exist
+        }
+
+        std::memmove(pos, pos + 1, (end - pos - 1) * sizeof(Entry));
+        leaf->header.count--;
+        page.mark_dirty();
+    }
+
+    std::vector<int> find(std::string_view key) {
+        ValueCollector values;
+        find_into(key, values);
+        return std::move(values.values);
+    }
+
+    // Pass the values of key to sink, ascending, a leaf's worth at a time
+    void find_into(std::string_view key, ValueSink& sink) {
+        Entry low(key, -1);  // Values are non-negative
+        int values[LEAF_CAPACITY];
+
+        for (int id = find_leaf(low); id != -1;) {
+            PageRef page = pool.fetch(id);
+            LeafNode* leaf = page.as<LeafNode>();
+            Entry* end = leaf->entries + leaf->header.count;
+            Entry* it = std::lower_bound(leaf->entries, end, low);
+            size_t n = 0;
+            for (; it != end && it->same_key(low); ++it) {
+                values[n++] = it->value;
+            }
+            sink.put(values, n);
+            if (it != end) {
+                break;  // Passed the last entry of this key
+            }
+            id = leaf->header.next;
+        }
+    }
+
+private:
+    int allocate_page() {
+        return meta.page_total++;
+    }
+
+    void save_meta() {
+        PageRef page = pool.fetch(0);
+        std::memcpy(page.as<MetaPage>(), &meta, sizeof(MetaPage));
+        page.mark_dirty();
+    }
+
+    static int child_index(const InternalNode* node, const Entry& target) {
+        return std::upper_bound(node->keys, node->keys + node->header.count, target) - node->keys;
+    }
+
+    int find_leaf(const Entry& target) {
+        int id = meta.root;
+        for (;;) {
+            PageRef page = pool.fetch(id);
+            InternalNode* node = page.as<InternalNode>();
+            if (node->header.is_leaf) {
+                return id;
+            }
+            id = node->children[child_index(node, target)];
+        }
+    }
+
+    // Insert target below page id; returns true and fills split if the
+    // page had to be split and the caller must add split.right
+    bool insert_into(int id, const Entry& target, Split& split) {
+        PageRef page = pool.fetch(id);
+        InternalNode* node = page.as<InternalNode>();
+        if (node->header.is_leaf) {
+            return insert_into_leaf(page, target, split);
+        }
+
+        int idx = child_index(node, target);
+        Split child_split;
+        if (!insert_into(node->children[idx], target, child_split)) {
+            return false;
+        }
+
+        int count = node->header.count;
+        std::memmove(node->keys + idx + 1, node->keys + idx, (count - idx) * sizeof(Entry));
+        std::memmove(node->children + idx + 2, node->children + idx + 1,
+                     (count - idx) * sizeof(int));
+        node->keys[idx] = child_split.separator;
+        node->children[idx + 1] = child_split.right;
+        node->header.count = ++count;
+        page.mark_dirty();
+
+        if (count < INTERNAL_CAPACITY) {
+            return false;
+        }
+
+        // Split the internal node; the middle key moves up
+        int mid = count / 2;
+        int right_id = allocate_page();
+        PageRef right_page = pool.create(right_id);
+        InternalNode* right = right_page.as<InternalNode>();
+
+        right->header = {0, count - mid - 1, -1};
+        std::memcpy(right->keys, node->keys + mid + 1, right->header.count * sizeof(Entry));
+        std::memcpy(right->children, node->children + mid + 1,
+                    (right->header.count + 1) * sizeof(int));
+        node->header.count = mid;
+
+        split = {node->keys[mid], right_id};
+        return true;
+    }
+
+    bool insert_into_leaf(PageRef& page, const Entry& target, Split& split) {
+        LeafNode* leaf = page.as<LeafNode>();
+        Entry* end = leaf->entries + leaf->header.count;
+        Entry* pos = std::lower_bound(leaf->entries, end, target);
+        if (pos != end && *pos == target) {
+            return false;  // Already exists
+        }
+
+        std::memmove(pos + 1, pos, (end - pos) * sizeof(Entry));
+        *pos = target;
+        int count = ++leaf->header.count;
+        page.mark_dirty();
+
+        if (count < LEAF_CAPACITY) {
+            return false;
+        }
+
+        // Split the leaf; the right half's first entry becomes the separator
+        int half = count / 2;
+        int right_id = allocate_page();
+        PageRef right_page = pool.create(right_id);
+        LeafNode* right = right_page.as<LeafNode>();
+
+        right->header = {1, count - half, leaf->header.next};
+        std::memcpy(right->entries, leaf->entries + half, right->header.count * sizeof(Entry));
+        leaf->header.count = half;
+        leaf->header.next = right_id;
+
+        split = {right->entries[0], right_id};
+        return true;
+    }
+};
+
+#endif  // BPLUS_TREE_HPP
@@ -0,0 +1,218 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "file_io.hpp"
+#include "metrics.hpp"
+
+// LRU cache of fixed-size file pages with a hard byte budget. All frame
+// memory is allocated up front (byte_budget / page_size frames), so the pool
+// never grows past its budget. Pages are pinned while in use and only
+// unpinned pages are evicted; dirty pages are written back on eviction and
+// on flush(), which also syncs the file.
+class BufferPool {
+private:
+    struct Frame {
+        int page_id;
+        int pin_count;
+        bool dirty;
+        std::list<int>::iterator lru_pos;
+    };
+
+    RandomAccessFile file;
+    size_t page_size;
+    int pages_on_disk;
+    ArenaVector<char> memory;
+    ArenaVector<Frame> frames;
+    std::unordered_map<int, int> frame_of;  // page id -> frame index
+    std::list<int> lru;                     // frame indices, most recent first
+    long long hits;
+    long long misses;
+    bool synced;  // nothing written back since the last flush()
+
+public:
+    // Pinned page; unpins itself when it goes out of scope
+    class PageRef {
+    private:
+        BufferPool* pool;
+        int page_id;
+        char* ptr;
+
+    public:
+        PageRef(BufferPool* p, int id, char* data) : pool(p), page_id(id), ptr(data) {}
+
+        PageRef(PageRef&& other) noexcept
+            : pool(other.pool), page_id(other.page_id), ptr(other.ptr) {
+            other.pool = nullptr;
+        }
+
+        PageRef(const PageRef&) = delete;
+        PageRef& operator=(const PageRef&) = delete;
+        PageRef& operator=(PageRef&&) = delete;
+
+        ~PageRef() {
+            if (pool) pool->unpin(page_id);
+        }
+
+        template <class T>
+        T* as() const {
+            return reinterpret_cast<T*>(ptr);
+        }
+
+        int id() const {
+            return page_id;
+        }
+
+        void mark_dirty() {
+            pool->mark_dirty(page_id);
+        }
+    };
+
+    BufferPool(const std::string& fname, size_t psize, size_t byte_budget)
+        : file(fname), page_size(psize), pages_on_disk(0), hits(0), misses(0), synced(true) {
+        size_t capacity = byte_budget / page_size;
+        if (capacity < 2) {
+            throw std::invalid_argument("buffer pool budget holds fewer than two pages");
+        }
+        memory.resize(capacity * page_size);
+        frames.assign(capacity, Frame{-1, 0, false, {}});
+
+        pages_on_disk = (file.size() + page_size - 1) / page_size;
+    }
+
+    ~BufferPool() {
+        flush();
+    }
+
+    // Number of pages the file held when it was opened
+    int page_count() const {
+        return pages_on_disk;
+    }
+
+    size_t capacity() const {
+        return frames.size();
+    }
+
+    long long hit_count() const {
+        return hits;
+    }
+
+    long long miss_count() const {
+        return misses;
+    }
+
+    const RandomAccessFile& io() const {
+        return file;
+    }
+
+    // Pin an existing page, reading it from disk on a miss
+    PageRef fetch(int page_id) {
+        int frame = acquire(page_id, true);
+        return PageRef(this, page_id, data(frame));
+    }
+
+    // Pin a page that the caller will initialize in full; no disk read
+    PageRef create(int page_id) {
+        int frame = acquire(page_id, false);
+        frames[frame].dirty = true;
+        return PageRef(this, page_id, data(frame));
+    }
+
+    void mark_dirty(int page_id) {
+        frames[frame_of.at(page_id)].dirty = true;
+    }
+
+    void unpin(int page_id) {
+        frames[frame_of.at(page_id)].pin_count--;
+    }
+
+    void flush() {
+        for (size_t i = 0; i < frames.size(); i++) {
+            if (frames[i].page_id != -1 && frames[i].dirty) {
+                write_back(i);
+            }
+        }
+        if (!synced) {
+            file.sync_data();
+            synced = true;
+        }
+    }
+
+    // Write page_id to disk now if it is dirty, and sync it, ahead of any
+    // page written back later
+    void write_page(int page_id) {
+        auto it = frame_of.find(page_id);
+        if (it != frame_of.end() && frames[it->second].dirty) {
+            write_back(it->second);
+            file.sync_data();
+            synced = true;
+        }
+    }
+
+private:
+    char* data(int frame) {
+        return memory.data() + static_cast<size_t>(frame) * page_size;
+    }
+
+    int acquire(int page_id, bool load) {
+        if (Metrics* m = Metrics::active()) m->file().pages++;
+        auto it = frame_of.find(page_id);
+        if (it != frame_of.end()) {
+            Frame& hit = frames[it->second];
+            hit.pin_count++;
+            lru.splice(lru.begin(), lru, hit.lru_pos);
+            hits++;
+            return it->second;
+        }
+        misses++;
+
+        int frame;
+        if (lru.size() < frames.size()) {
+            frame = lru.size();
+            lru.push_front(frame);
+        } else {
+            frame = evict();
+            lru.splice(lru.begin(), lru, frames[frame].lru_pos);
+        }
+
+        frames[frame] = Frame{page_id, 1, false, lru.begin()};
+        frame_of[page_id] = frame;
+        if (load) {
+            // A short read past EOF leaves the rest of the frame unspecified
+            file.read_at(static_cast<long long>(page_id) * page_size, data(frame), page_size);
+        }
+        return frame;
+    }
+
+    // Free the least recently used unpinned frame
+    int evict() {
+        for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+            Frame& victim = frames[*it];
+            if (victim.pin_count > 0) {
+                continue;
+            }
+            if (victim.dirty) {
+                write_back(*it);
+            }
+            frame_of.erase(victim.page_id);
+            return *it;
+        }
+        throw std::runtime_error("buffer pool exhausted: every frame is pinned");
+    }
+
+    void write_back(int frame) {
+        file.write_at(static_cast<long long>(frames[frame].page_id) * page_size,
+                      data(frame), page_size);
+        frames[frame].dirty = false;
+        synced = false;
+    }
+};
+
+#endif  // BUFFER_POOL_HPP
@@ -0,0 +1,106 @@
+#ifndef COMMAND_LOOP_HPP
+#define COMMAND_LOOP_HPP
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "arena.hpp"
+#include "command_window.hpp"
+#include "input_reader.hpp"
+#include "metrics.hpp"
+#include "output_writer.hpp"
+#include "storage_engine.hpp"
+
+// Commands run per window; "--window=1" runs them strictly one at a time
+static const size_t DEFAULT_WINDOW = 4096;
+
+// run_commands() without the metrics check
+inline int run_commands_on(StorageEngine& storage, int argc, char* argv[]) {
+    size_t window = DEFAULT_WINDOW;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.substr(0, 9) == "--window=") {
+            window = strtoul(argv[i] + 9, nullptr, 10);
+        }
+    }
+
+    using Commands = CommandWindow<StorageEngine>;
+    InputReader input(STDIN_FILENO);
+    OutputWriter output(STDOUT_FILENO);
+    Commands commands(storage, output, window);
+
+    int n = 0;
+    if (input.next_line()) {
+        input.next_int(n);
+    }
+
+    for (int i = 0; i < n && input.next_line(); i++) {
+        std::string_view command, key;
+        int value = 0;
+        input.next(command);
+
+        if (command == "insert") {
+            if (input.next(key) && input.next_int(value)) {
+                commands.add(Commands::INSERT, key, value);
+            }
+        } else if (command == "delete") {
+            if (input.next(key) && input.next_int(value)) {
+                commands.add(Commands::REMOVE, key, value);
+            }
+        } else if (command == "find") {
+            input.next(key);
+            commands.add(Commands::FIND, key, value);
+        }
+    }
+
+    commands.run();
+    output.flush();
+    storage.flush();
+    return 0;
+}
+
+// Run fn, the body of a run, turning the errors it can stop on into its
+// exit status: 3 when the arena runs out of memory, 4 when a backend cannot
+// read or write its files, such as one left by another format
+template <class Fn>
+inline int exit_status_of(Fn fn) {
+    try {
+        return fn();
+    } catch (const MemoryBudgetExceeded& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 3;
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 4;
+    }
+}
+
+// Answer the commands on stdin against storage, writing find results to
+// stdout. With metrics on, every engine call goes through a MeteredEngine.
+inline int run_commands(StorageEngine& storage, int argc, char* argv[]) {
+    return exit_status_of([&] {
+        if (Metrics* metrics = Metrics::active()) {
+            MeteredEngine metered(storage, *metrics);
+            return run_commands_on(metered, argc, argv);
+        }
+        return run_commands_on(storage, argc, argv);
+    });
+}
+
+// Open a Storage from args and run the commands against it. This is the
+// whole program once main() has picked a backend; errors opening the files
+// stop the run like errors during it.
+template <class Storage, class... Args>
+inline int open_and_run(int argc, char* argv[], Args&&... args) {
+    return exit_status_of([&] {
+        Storage storage(std::forward<Args>(args)...);
+        return run_commands(storage, argc, argv);
+    });
+}
+
+#endif  // COMMAND_LOOP_HPP
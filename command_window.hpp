@@ -0,0 +1,319 @@
+#ifndef COMMAND_WINDOW_HPP
+#define COMMAND_WINDOW_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "output_writer.hpp"
+#include "storage_engine.hpp"
+
+// Runs commands a window at a time against a storage engine with
+// insert/remove/find. Commands on different keys commute, so a window is
+// regrouped by key (in key order, which walks the engine's files front to
+// back) and every group is run in one pass:
+//   - if the group has a find, the key's values are read from storage once
+//     and the group's inserts and deletes are replayed on that copy, so
+//     every find sees exactly the commands before it;
+//   - only the last insert or delete of each (key, value) pair reaches
+//     storage, which leaves it in the same state as running them all.
+// Results are written in the original command order, so the output is the
+// same as running the commands one by one. A window of one command is the
+// plain sequential loop.
+//
+// Find results are held until the window is written out. Storage is only
+// changed once every find is answered, so a window whose results outgrow
+// RESULT_BUDGET values is dropped and run as two halves instead, and the
+// next windows are made smaller until results fit again.
+//
+// A find that is the only command on its key in the commands being run is
+// not answered ahead: when its turn comes to be written out, the key's
+// values are streamed from storage straight to the output, as none of the
+// other commands can have changed them. A key with other commands in the
+// span is read into memory only while it has at most RESULT_BUDGET values;
+// past that the span is split, until each of the key's finds is alone on
+// it and streamed. That keeps the huge value sets of hot keys out of
+// memory.
+template <class Storage>
+class CommandWindow {
+public:
+    enum Op : char { INSERT = 'i', REMOVE = 'r', FIND = 'f' };
+
+private:
+    struct Command {
+        Op op;
+        uint32_t key_offset;  // into keys
+        uint32_t key_length;
+        int value;
+        uint32_t result_offset;  // into results, for a find; STREAMED if it has none
+        uint32_t result_count;
+    };
+
+    static const uint32_t STREAMED = UINT32_MAX;
+
+    // Writes values to the output as a find result line
+    class ResultSink : public ValueSink {
+    private:
+        OutputWriter& output;
+        bool empty;
+
+    public:
+        explicit ResultSink(OutputWriter& out) : output(out), empty(true) {}
+
+        void put(const int* values, size_t n) override {
+            for (size_t j = 0; j < n; j++) {
+                if (!empty) output.put(' ');
+                output.write_int(values[j]);
+                empty = false;
+            }
+        }
+
+        void finish() {
+            output.write(empty ? "null\n" : "\n");
+        }
+    };
+
+    // Collects a key's values, giving up on a key with more than
+    // RESULT_BUDGET of them
+    class LiveSink : public ValueSink {
+    private:
+        ArenaVector<int>& values;
+        bool overflowed;
+
+    public:
+        explicit LiveSink(ArenaVector<int>& out) : values(out), overflowed(false) {
+            values.clear();
+        }
+
+        void put(const int* v, size_t n) override {
+            if (overflowed) {
+                return;
+            }
+            if (values.size() + n > RESULT_BUDGET) {
+                overflowed = true;
+                values.clear();
+                return;
+            }
+            values.insert(values.end(), v, v + n);
+        }
+
+        bool complete() const {
+            return !overflowed;
+        }
+    };
+
+    // Last mutation of one value within a group
+    struct Mutation {
+        int value;
+        uint32_t seq;
+        Op op;
+    };
+
+    // Mutation left for storage once the span's finds are answered
+    struct Pending {
+        uint32_t command;  // for the key
+        int value;
+        Op op;
+    };
+
+    static const size_t RESULT_BUDGET = 64 * 1024;  // values held per window
+
+    Storage& storage;
+    OutputWriter& output;
+    size_t max_capacity;
+    size_t capacity;
+    ArenaVector<Command> commands;
+    ArenaVector<char> keys;          // key bytes of the window
+    ArenaVector<uint32_t> by_key;    // command indices grouped by key
+    ArenaVector<int> live;           // values of the group's key, as storage holds them
+    ArenaVector<Mutation> mutations;
+    ArenaVector<Pending> pending;
+    ArenaVector<int> results;        // find results of the span being run
+    size_t spans;                    // spans the current window took
+
+public:
+    CommandWindow(Storage& s, OutputWriter& out, size_t window)
+        : storage(s), output(out), max_capacity(window > 0 ? window : 1), capacity(max_capacity), spans(0) {
+        commands.reserve(capacity);
+        by_key.reserve(capacity);
+    }
+
+    ~CommandWindow() {
+        if (std::uncaught_exceptions() == 0) {
+            run();
+        }
+    }
+
+    void add(Op op, std::string_view key, int value) {
+        commands.push_back({op, static_cast<uint32_t>(keys.size()),
+                            static_cast<uint32_t>(key.size()), value, 0, 0});
+        keys.insert(keys.end(), key.begin(), key.end());
+        if (commands.size() >= capacity) {
+            run();
+        }
+    }
+
+    // Execute and answer every buffered command
+    void run() {
+        if (commands.empty()) {
+            return;
+        }
+
+        spans = 0;
+        run_span(0, commands.size());
+        if (spans > 1) {
+            capacity = std::max<size_t>(1, commands.size() / spans);
+        } else if (capacity < max_capacity) {
+            capacity = std::min(max_capacity, capacity * 2);
+        }
+        commands.clear();
+        keys.clear();
+        results.clear();
+    }
+
+private:
+    std::string_view key_of(uint32_t i) const {
+        return std::string_view(keys.data() + commands[i].key_offset, commands[i].key_length);
+    }
+
+    // Run commands[first, last), or its two halves one after the other if
+    // their find results outgrow RESULT_BUDGET
+    void run_span(size_t first, size_t last) {
+        if (!answer(first, last) && last - first > 1) {
+            size_t middle = first + (last - first) / 2;
+            run_span(first, middle);
+            run_span(middle, last);
+            return;
+        }
+        spans++;
+
+        for (const Pending& p : pending) {
+            if (p.op == INSERT) {
+                storage.insert(key_of(p.command), p.value);
+            } else {
+                storage.remove(key_of(p.command), p.value);
+            }
+        }
+        for (size_t i = first; i < last; i++) {
+            if (commands[i].op == FIND) {
+                write_result(i);
+            }
+        }
+    }
+
+    // Answer the finds of commands[first, last) and collect the mutations
+    // they leave for storage; false once the results outgrow RESULT_BUDGET
+    bool answer(size_t first, size_t last) {
+        results.clear();
+        pending.clear();
+        by_key.clear();
+        for (size_t i = first; i < last; i++) {
+            by_key.push_back(i);
+        }
+        std::sort(by_key.begin(), by_key.end(), [&](uint32_t a, uint32_t b) {
+            int cmp = key_of(a).compare(key_of(b));
+            return cmp != 0 ? cmp < 0 : a < b;
+        });
+
+        for (size_t group = 0; group < by_key.size();) {
+            size_t end = group + 1;
+            while (end < by_key.size() && key_of(by_key[end]) == key_of(by_key[group])) end++;
+            if (!run_group(group, end)) {
+                return false;
+            }
+            group = end;
+        }
+        return true;
+    }
+
+    // Run by_key[first, last), the commands of one key in original order;
+    // false as soon as the key's values or the results outgrow
+    // RESULT_BUDGET, as a hot key's can within one group
+    bool run_group(size_t first, size_t last) {
+        std::string_view key = key_of(by_key[first]);
+        if (last - first == 1 && commands[by_key[first]].op == FIND) {
+            commands[by_key[first]].result_offset = STREAMED;
+            return true;
+        }
+
+        bool has_find = false;
+        for (size_t i = first; i < last; i++) {
+            if (commands[by_key[i]].op == FIND) has_find = true;
+        }
+        if (has_find) {
+            LiveSink sink(live);
+            storage.find_into(key, sink);
+            if (!sink.complete()) {
+                return false;
+            }
+        }
+
+        mutations.clear();
+        bool changed = true;  // live differs from the last find's result
+        uint32_t last_offset = 0;
+        for (size_t i = first; i < last; i++) {
+            Command& cmd = commands[by_key[i]];
+            if (cmd.op == FIND) {
+                if (changed) {
+                    if (results.size() + live.size() > RESULT_BUDGET && results.size() > 0) {
+                        return false;
+                    }
+                    last_offset = results.size();
+                    results.insert(results.end(), live.begin(), live.end());
+                    changed = false;
+                }
+                cmd.result_offset = last_offset;
+                cmd.result_count = live.size();
+                continue;
+            }
+
+            mutations.push_back({cmd.value, static_cast<uint32_t>(i), cmd.op});
+            if (has_find) {
+                auto it = std::lower_bound(live.begin(), live.end(), cmd.value);
+                bool present = it != live.end() && *it == cmd.value;
+                if (cmd.op == INSERT && !present) {
+                    live.insert(it, cmd.value);
+                    changed = true;
+                } else if (cmd.op == REMOVE && present) {
+                    live.erase(it);
+                    changed = true;
+                }
+            }
+        }
+
+        // Keep the last mutation of every value
+        std::sort(mutations.begin(), mutations.end(), [](const Mutation& a, const Mutation& b) {
+            return a.value != b.value ? a.value < b.value : a.seq < b.seq;
+        });
+        for (size_t i = 0; i < mutations.size(); i++) {
+            const Mutation& m = mutations[i];
+            if (i + 1 < mutations.size() && mutations[i + 1].value == m.value) continue;
+            pending.push_back({by_key[first], m.value, m.op});
+        }
+        return true;
+    }
+
+    void write_result(uint32_t i) {
+        const Command& cmd = commands[i];
+        if (cmd.result_offset == STREAMED) {
+            ResultSink sink(output);
+            storage.find_into(key_of(i), sink);
+            sink.finish();
+            return;
+        }
+        if (cmd.result_count == 0) {
+            output.write("null\n");
+            return;
+        }
+        for (uint32_t j = 0; j < cmd.result_count; j++) {
+            if (j > 0) output.put(' ');
+            output.write_int(results[cmd.result_offset + j]);
+        }
+        output.put('\n');
+    }
+};
+
+#endif  // COMMAND_WINDOW_HPP
@@ -0,0 +1,54 @@
+#ifndef ENTRY_HPP
+#define ENTRY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Structure to store key-value pair
+struct Entry {
+    uint64_t fingerprint;  // hash of key; compared before any strcmp
+    char key[65];  // 64 bytes + null terminator
+    int value;
+
+    Entry() = default;
+
+    // Every byte is set, padding and the key's tail after the NUL
+    // included, so an entry is the same bytes in every file and log record
+    // and checksums over it are deterministic
+    Entry(std::string_view k, int v) {
+        memset(this, 0, sizeof(Entry));
+        value = v;
+        size_t len = k.size() < 64 ? k.size() : 64;
+        memcpy(key, k.data(), len);
+        key[len] = '\0';
+        fingerprint = hash_key(key, len);
+    }
+
+    // 64-bit FNV-1a
+    static uint64_t hash_key(const char* s, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++) {
+            h ^= static_cast<unsigned char>(s[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    bool same_key(const Entry& other) const {
+        return fingerprint == other.fingerprint && strcmp(key, other.key) == 0;
+    }
+
+    bool operator<(const Entry& other) const {
+        int key_cmp = strcmp(key, other.key);
+        if (key_cmp != 0) return key_cmp < 0;
+        return value < other.value;
+    }
+
+    bool operator==(const Entry& other) const {
+        return value == other.value && same_key(other);
+    }
+};
+
+#endif  // ENTRY_HPP
@@ -0,0 +1,316 @@
+#ifndef ENTRY_FILE_HPP
+#define ENTRY_FILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "entry.hpp"
+#include "file_io.hpp"
+
+// File of Entry records in checksummed blocks:
+//   [header] [block 0] [block 1] ...
+// each BLOCK_BYTES long. The header holds a magic number, the format
+// version, a generation number and how many leading entries are sorted; it
+// is written once, when the file is committed, so opening a file reads and
+// checks only the header and the last block. A block is
+// [count:4][checksum:4][entries], the checksum covering the count and the
+// entries, and is verified the first time it is read.
+//
+// Blocks are only ever added, never rewritten, so a crash can tear at most
+// the last one, which is dropped on open. The sorted prefix is written in
+// full blocks, so its i-th entry is at a known place and can be binary
+// searched; blocks appended after it may be partly filled.
+//
+// A file is rewritten by create()ing a temporary one, appending to it and
+// commit()ting it over the old one, which syncs it and renames it into
+// place: readers after a crash see the old file or the new one, whole.
+//
+// A file left by the original headerless format, a bare array of
+// LegacyEntry records, is converted the first time it is opened: its
+// entries are sorted into a file of generation 0, as a compaction would
+// leave them, and committed over it.
+class EntryFile {
+public:
+    static constexpr size_t BLOCK_BYTES = 4096;
+    static constexpr size_t BLOCK_ENTRIES = (BLOCK_BYTES - 2 * sizeof(uint32_t)) / sizeof(Entry);
+    static const uint32_t MAGIC = 0x4c4f4731;  // "LOG1"
+    static const uint32_t VERSION = 1;
+    static constexpr size_t READ_BLOCKS = 64;  // per read when reading many
+
+    struct Block {
+        uint32_t count;
+        uint32_t checksum;  // of count and entries[0, count)
+        Entry entries[BLOCK_ENTRIES];
+        char unused[BLOCK_BYTES - 2 * sizeof(uint32_t) - BLOCK_ENTRIES * sizeof(Entry)];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t block_bytes;
+        uint32_t checksum;  // of the header with this field zero
+        uint64_t generation;
+        uint64_t sorted_count;
+    };
+
+    // Record of the original format: no header, no blocks, no fingerprint
+    struct LegacyEntry {
+        char key[65];
+        int value;
+    };
+
+    static_assert(sizeof(Block) == BLOCK_BYTES, "a block fills BLOCK_BYTES exactly");
+
+private:
+    std::string path;
+    std::unique_ptr<RandomAccessFile> file;
+    Header header;
+    size_t blocks;
+    size_t tail;  // entries in blocks after the sorted prefix
+    std::vector<bool> verified;  // blocks whose checksum has been checked
+    std::unique_ptr<Block> cached;  // last block read by at()
+    size_t cached_id;
+
+    EntryFile(const std::string& fname, bool truncate)
+        : path(fname), file(new RandomAccessFile(fname)), header(), blocks(0), tail(0), cached(new Block()),
+          cached_id(SIZE_MAX) {
+        if (truncate) {
+            file->truncate(0);
+        }
+    }
+
+public:
+    // Opens fname, creating an empty file of generation 0 if there is none
+    explicit EntryFile(const std::string& fname) : EntryFile(fname, false) {
+        long long size = file->size();
+        if (size == 0) {
+            EntryFile fresh = create(fname + ".tmp");
+            fresh.commit(0, 0, fname);
+            *this = std::move(fresh);
+            return;
+        }
+
+        bool has_header = size >= static_cast<long long>(BLOCK_BYTES) &&
+                          file->read_at(0, &header, sizeof(header)) == sizeof(header) && header.magic == MAGIC;
+        if (!has_header && size % sizeof(LegacyEntry) == 0) {
+            *this = convert_legacy(fname, size);
+            return;
+        }
+        if (!has_header || header.checksum != header_checksum(header)) {
+            throw std::runtime_error("bad entry file " + fname);
+        }
+        if (header.version != VERSION || header.block_bytes != BLOCK_BYTES) {
+            throw std::runtime_error("entry file " + fname + " has unsupported format version " +
+                                     std::to_string(header.version));
+        }
+
+        // A block torn by a crash while it was appended is dropped; its
+        // entries are still in the caller's write-ahead log
+        blocks = size / BLOCK_BYTES - 1;
+        if (blocks < sorted_blocks()) {
+            throw std::runtime_error("entry file " + fname + " is missing blocks");
+        }
+        verified.assign(blocks, false);
+        size_t last_count = BLOCK_ENTRIES;
+        if (blocks > sorted_blocks()) {
+            file->read_at(offset_of(blocks - 1), cached.get(), BLOCK_BYTES);
+            if (!valid(*cached)) {
+                blocks--;
+                verified.pop_back();
+            } else {
+                last_count = cached->count;
+            }
+        }
+        // Only the last block is read here; any before it count as full
+        if (blocks > sorted_blocks()) {
+            tail = (blocks - sorted_blocks() - 1) * BLOCK_ENTRIES + last_count;
+        }
+        if (size != static_cast<long long>(offset_of(blocks))) {
+            file->truncate(offset_of(blocks));
+        }
+    }
+
+    EntryFile(EntryFile&&) = default;
+    EntryFile& operator=(EntryFile&&) = default;
+
+    // Empty file at fname to append to and then commit()
+    static EntryFile create(const std::string& fname) {
+        EntryFile f(fname, true);
+        f.header.sorted_count = 0;
+        return f;
+    }
+
+    // Write the header, sync the file and rename it to target, which this
+    // then refers to
+    void commit(uint64_t generation, uint64_t sorted_count, const std::string& target) {
+        header = {MAGIC, VERSION, BLOCK_BYTES, 0, generation, sorted_count};
+        header.checksum = header_checksum(header);
+        std::vector<char> head(BLOCK_BYTES, 0);
+        memcpy(head.data(), &header, sizeof(header));
+        file->write_at(0, head.data(), head.size());
+        tail -= std::min<size_t>(tail, sorted_count);
+        file->sync();
+        replace_file(path, target);
+        path = target;
+        file.reset(new RandomAccessFile(target));
+    }
+
+    // Force everything written to the file so far to the device
+    void sync() {
+        file->sync_data();
+    }
+
+    // Write entries to new blocks at the end of the file, all full but the
+    // last
+    void append(const Entry* entries, size_t n) {
+        if (n == 0) {
+            return;
+        }
+        size_t count = (n + BLOCK_ENTRIES - 1) / BLOCK_ENTRIES;
+        std::vector<Block> out(count);
+        for (size_t b = 0; b < count; b++) {
+            size_t first = b * BLOCK_ENTRIES;
+            size_t k = std::min(BLOCK_ENTRIES, n - first);
+            out[b].count = k;
+            memcpy(out[b].entries, entries + first, k * sizeof(Entry));
+            out[b].checksum = block_checksum(out[b]);
+        }
+        file->write_at(offset_of(blocks), out.data(), count * sizeof(Block));
+        blocks += count;
+        tail += n;
+        verified.resize(blocks, true);
+    }
+
+    // Append the entries of blocks [first, first + n) to out, a vector of
+    // Entry; returns the number of blocks read
+    template <class Entries>
+    size_t read_blocks(size_t first, size_t n, Entries& out) {
+        if (first >= blocks) {
+            return 0;
+        }
+        n = std::min(n, blocks - first);
+        std::vector<Block> in(std::min(n, READ_BLOCKS));
+        for (size_t done = 0; done < n;) {
+            size_t k = std::min(n - done, in.size());
+            file->read_at(offset_of(first + done), in.data(), k * sizeof(Block));
+            for (size_t b = 0; b < k; b++) {
+                check(first + done + b, in[b]);
+                out.insert(out.end(), in[b].entries, in[b].entries + in[b].count);
+            }
+            done += k;
+        }
+        return n;
+    }
+
+    std::vector<Entry> read_all() {
+        std::vector<Entry> entries;
+        entries.reserve(blocks * BLOCK_ENTRIES);
+        read_blocks(0, blocks, entries);
+        return entries;
+    }
+
+    // Entry i of the sorted prefix
+    const Entry& at(size_t i) {
+        size_t b = i / BLOCK_ENTRIES;
+        if (b != cached_id) {
+            file->read_at(offset_of(b), cached.get(), sizeof(Block));
+            check(b, *cached);
+            cached_id = b;
+        }
+        return cached->entries[i % BLOCK_ENTRIES];
+    }
+
+    // Throws if block id, as read from the file or a mapping of it, does not
+    // match its checksum; checked once per block
+    void check(size_t id, const Block& block) {
+        if (verified[id]) {
+            return;
+        }
+        if (!valid(block)) {
+            throw std::runtime_error("checksum mismatch in block " + std::to_string(id) + " of " + path);
+        }
+        verified[id] = true;
+    }
+
+    static size_t offset_of(size_t block) {
+        return (block + 1) * BLOCK_BYTES;
+    }
+
+    size_t block_count() const {
+        return blocks;
+    }
+
+    // Blocks of the sorted prefix
+    size_t sorted_blocks() const {
+        return (header.sorted_count + BLOCK_ENTRIES - 1) / BLOCK_ENTRIES;
+    }
+
+    size_t sorted_count() const {
+        return header.sorted_count;
+    }
+
+    // Entries appended after the sorted prefix
+    size_t tail_count() const {
+        return tail;
+    }
+
+    uint64_t generation() const {
+        return header.generation;
+    }
+
+    const std::string& name() const {
+        return path;
+    }
+
+    RandomAccessFile& raw() {
+        return *file;
+    }
+
+private:
+    // Rewrite the headerless file fname, size bytes of LegacyEntry records,
+    // in this format, sorted and without duplicates
+    EntryFile convert_legacy(const std::string& fname, long long size) {
+        std::vector<LegacyEntry> legacy(size / sizeof(LegacyEntry));
+        if (file->read_at(0, legacy.data(), size) != static_cast<size_t>(size)) {
+            throw std::runtime_error("cannot read " + fname);
+        }
+        std::vector<Entry> entries;
+        entries.reserve(legacy.size());
+        for (const LegacyEntry& old : legacy) {
+            const void* end = memchr(old.key, '\0', sizeof(old.key));
+            if (end == nullptr) {
+                throw std::runtime_error("bad entry file " + fname);
+            }
+            entries.emplace_back(std::string_view(old.key, static_cast<const char*>(end) - old.key), old.value);
+        }
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+        EntryFile converted = create(fname + ".tmp");
+        converted.append(entries.data(), entries.size());
+        converted.commit(0, entries.size(), fname);
+        return converted;
+    }
+
+    static bool valid(const Block& block) {
+        return block.count <= BLOCK_ENTRIES && block.checksum == block_checksum(block);
+    }
+
+    static uint32_t block_checksum(const Block& block) {
+        uint64_t h = checksum(&block.count, sizeof(block.count));
+        return static_cast<uint32_t>(checksum(block.entries, block.count * sizeof(Entry), h));
+    }
+
+    static uint32_t header_checksum(Header h) {
+        h.checksum = 0;
+        return static_cast<uint32_t>(checksum(&h, sizeof(h)));
+    }
+};
+
+#endif  // ENTRY_FILE_HPP
@@ -0,0 +1,247 @@
+#ifndef FILE_IO_HPP
+#define FILE_IO_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "metrics.hpp"
+
+// File opened once for the lifetime of the owner and accessed with
+// positioned pread/pwrite, so no stream construction or seek is needed per
+// access. Counts calls and bytes in each direction, and reports every
+// system call to Metrics when that is on.
+class RandomAccessFile {
+private:
+    std::string filename;
+    int fd;
+    long long read_calls;
+    long long write_calls;
+    long long bytes_read;
+    long long bytes_written;
+    long long next_offset;  // where the last access ended
+
+public:
+    // Opens fname for reading and writing, creating it if it doesn't exist
+    explicit RandomAccessFile(const std::string& fname)
+        : filename(fname), fd(-1), read_calls(0), write_calls(0), bytes_read(0), bytes_written(0),
+          next_offset(0) {
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + filename + ": " + strerror(errno));
+        }
+        if (Metrics* m = Metrics::active()) {
+            m->file().opens++;
+            m->file().syscalls++;
+        }
+    }
+
+    RandomAccessFile(const RandomAccessFile&) = delete;
+    RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+    ~RandomAccessFile() {
+        if (fd >= 0) {
+            ::close(fd);
+            if (Metrics* m = Metrics::active()) m->file().syscalls++;
+        }
+    }
+
+    // Read up to n bytes at offset; returns the number of bytes read, which
+    // is short only at end of file
+    size_t read_at(long long offset, void* buf, size_t n) {
+        char* p = static_cast<char*>(buf);
+        size_t done = 0;
+        long long calls = 0;
+        while (done < n) {
+            ssize_t got = ::pread(fd, p + done, n - done, offset + done);
+            calls++;
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("read from " + filename + " failed: " + strerror(errno));
+            }
+            if (got == 0) break;
+            done += got;
+        }
+        read_calls += calls;
+        bytes_read += done;
+        if (Metrics* m = Metrics::active()) m->file_access(false, offset, done, calls, offset != next_offset);
+        next_offset = offset + done;
+        return done;
+    }
+
+    void write_at(long long offset, const void* buf, size_t n) {
+        const char* p = static_cast<const char*>(buf);
+        size_t done = 0;
+        long long calls = 0;
+        while (done < n) {
+            ssize_t put = ::pwrite(fd, p + done, n - done, offset + done);
+            calls++;
+            if (put < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("write to " + filename + " failed: " + strerror(errno));
+            }
+            done += put;
+        }
+        write_calls += calls;
+        bytes_written += done;
+        if (Metrics* m = Metrics::active()) m->file_access(true, offset, done, calls, offset != next_offset);
+        next_offset = offset + done;
+    }
+
+    long long size() const {
+        if (Metrics* m = Metrics::active()) m->file().syscalls++;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            return 0;
+        }
+        return st.st_size;
+    }
+
+    void truncate(long long length) {
+        if (Metrics* m = Metrics::active()) m->file().syscalls++;
+        if (::ftruncate(fd, length) != 0) {
+            throw std::runtime_error("truncate of " + filename + " failed: " + strerror(errno));
+        }
+    }
+
+    // Force everything written so far to the device
+    void sync() {
+        if (Metrics* m = Metrics::active()) m->file().syscalls++;
+        if (::fsync(fd) != 0) {
+            throw std::runtime_error("sync of " + filename + " failed: " + strerror(errno));
+        }
+    }
+
+    // Force the data written so far to the device, and only as much
+    // metadata as reading it back needs
+    void sync_data() {
+        if (Metrics* m = Metrics::active()) m->file().syscalls++;
+        if (::fdatasync(fd) != 0) {
+            throw std::runtime_error("sync of " + filename + " failed: " + strerror(errno));
+        }
+    }
+
+    const std::string& name() const {
+        return filename;
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+
+    long long read_count() const {
+        return read_calls;
+    }
+
+    long long write_count() const {
+        return write_calls;
+    }
+
+    long long read_bytes() const {
+        return bytes_read;
+    }
+
+    long long written_bytes() const {
+        return bytes_written;
+    }
+};
+
+// 64-bit multiply-xorshift hash of n bytes, 8 bytes per step; h chains
+// the checksum of one piece into the next
+inline uint64_t checksum(const void* data, size_t n, uint64_t h = 0) {
+    const char* p = static_cast<const char*>(data);
+    h ^= 0x9e3779b97f4a7c15ULL + n;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+// Make renames within the directory holding path durable
+inline void sync_directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+// Atomically put the file at from in place of the one at to. from should
+// be synced first; the directory is synced after, so the swap survives a
+// crash either way: readers see the old file or the new one, never a mix.
+inline void replace_file(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        throw std::runtime_error("cannot replace " + to + ": " + strerror(errno));
+    }
+    sync_directory_of(to);
+}
+
+// Read-only shared mapping of a whole file. The owner calls remap() after
+// the file grows or shrinks; touching bytes past the mapped length, or past
+// the end of a file truncated since the last remap(), is not allowed.
+class MemoryMap {
+private:
+    const char* base;
+    size_t length;
+
+public:
+    MemoryMap() : base(nullptr), length(0) {}
+
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap& operator=(const MemoryMap&) = delete;
+
+    ~MemoryMap() {
+        unmap();
+    }
+
+    void remap(const RandomAccessFile& file) {
+        size_t new_length = file.size();
+        if (base != nullptr && new_length == length) {
+            return;
+        }
+        unmap();
+        if (new_length == 0) {
+            return;
+        }
+        void* p = ::mmap(nullptr, new_length, PROT_READ, MAP_SHARED, file.descriptor(), 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + file.name() + ": " + strerror(errno));
+        }
+        base = static_cast<const char*>(p);
+        length = new_length;
+    }
+
+    void unmap() {
+        if (base != nullptr) {
+            ::munmap(const_cast<char*>(base), length);
+            base = nullptr;
+            length = 0;
+        }
+    }
+
+    const char* data() const {
+        return base;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+#endif  // FILE_IO_HPP
@@ -0,0 +1,127 @@
+#ifndef INPUT_READER_HPP
+#define INPUT_READER_HPP
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Line-at-a-time tokenizer over a file descriptor that never allocates per
+// token. Input is read in CHUNK_BYTES pieces into one reusable buffer, a
+// regular file as well as a pipe: mapping the file instead would keep every
+// page read so far resident. next_line() makes sure the whole line is in
+// memory, so the views next() hands out stay valid until the following
+// next_line() call.
+class InputReader {
+private:
+    static const size_t CHUNK_BYTES = 64 * 1024;
+
+    int fd;
+    std::vector<char> buffer;
+    const char* pos;       // next unread byte
+    const char* end;       // end of the bytes available
+    const char* line_end;  // end of the current line
+    bool at_eof;
+
+public:
+    explicit InputReader(int input_fd) : fd(input_fd), buffer(CHUNK_BYTES), at_eof(false) {
+        pos = end = line_end = buffer.data();
+    }
+
+    InputReader(const InputReader&) = delete;
+    InputReader& operator=(const InputReader&) = delete;
+
+    // Move to the next line that is not blank; false at end of input
+    bool next_line() {
+        pos = line_end;
+        for (;;) {
+            while (pos < end && is_space(*pos)) pos++;
+            if (pos < end) break;
+            if (!fill()) {
+                line_end = pos;
+                return false;
+            }
+        }
+        for (;;) {
+            const void* newline = memchr(pos, '\n', end - pos);
+            if (newline != nullptr) {
+                line_end = static_cast<const char*>(newline);
+                return true;
+            }
+            if (!fill()) {
+                line_end = end;  // Last line without a newline
+                return true;
+            }
+        }
+    }
+
+    // Next whitespace-separated token of the current line
+    bool next(std::string_view& token) {
+        while (pos < line_end && is_space(*pos)) pos++;
+        if (pos == line_end) {
+            return false;
+        }
+        const char* start = pos;
+        while (pos < line_end && !is_space(*pos)) pos++;
+        token = std::string_view(start, pos - start);
+        return true;
+    }
+
+    // Next token of the current line as a decimal integer
+    bool next_int(int& value) {
+        std::string_view token;
+        if (!next(token)) {
+            return false;
+        }
+        size_t i = 0;
+        bool negative = token[0] == '-';
+        if (negative || token[0] == '+') i++;
+        if (i == token.size()) {
+            return false;
+        }
+
+        unsigned int result = 0;
+        for (; i < token.size(); i++) {
+            unsigned int digit = token[i] - '0';
+            if (digit > 9) return false;
+            result = result * 10 + digit;
+        }
+        value = negative ? -static_cast<int>(result) : static_cast<int>(result);
+        return true;
+    }
+
+private:
+    static bool is_space(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Read more input after the unread bytes, moving them to the front of
+    // the buffer; false once input is exhausted
+    bool fill() {
+        if (at_eof) {
+            return false;
+        }
+        size_t keep = end - pos;
+        memmove(buffer.data(), pos, keep);
+        if (keep == buffer.size()) {
+            buffer.resize(buffer.size() * 2);  // A line longer than the buffer
+        }
+        pos = buffer.data();
+        end = pos + keep;
+
+        ssize_t got;
+        do {
+            got = ::read(fd, buffer.data() + keep, buffer.size() - keep);
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0) {
+            at_eof = true;
+            return false;
+        }
+        end += got;
+        return true;
+    }
+};
+
+#endif  // INPUT_READER_HPP
@@ -0,0 +1,598 @@
+#ifndef LOG_STORAGE_HPP
+#define LOG_STORAGE_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "entry.hpp"
+#include "entry_file.hpp"
+#include "file_io.hpp"
+#include "storage_engine.hpp"
+
+// Append-only storage: inserts go to the end of the data file, deletes to a
+// tombstone file, and both are merged back by compact_files(). Both are
+// EntryFiles, in checksummed blocks behind a versioned header.
+//
+// The tombstone file is kept sorted in Entry order, like the compacted data
+// file, with the latest deletes held sorted in memory until merged in. A
+// find looks up the tombstones of its key by binary search, so its cost
+// does not grow with the number of deletes. Inserting a pair again drops
+// its tombstone, since it would hide the new copy too: a pending one at
+// once, a stored one through a sorted set of cancellations that is applied
+// whenever the tombstone file is merged or compacted. Merging streams the
+// file through in READ_BLOCKS pieces, so it never has to fit in memory.
+//
+// Inserts, deletes and cancellations are buffered up to PENDING_ENTRIES
+// each. Compaction runs once the unsorted tail and the tombstones together
+// pass 1/COMPACT_FRACTION of the sorted entries (and MIN_COMPACT_ENTRIES),
+// so the number of times an entry is rewritten stays bounded as the file
+// grows.
+//
+// Compaction is an external merge sort within COMPACT_BUDGET bytes: both
+// files are cut into sorted chunks spilled to one scratch file, and a k-way
+// merge writes the data file back in order, skipping duplicates and every
+// pair with a tombstone. Files that fit in the budget are merged straight
+// from memory.
+//
+// Compaction never touches the files in place. The merge goes to a new data
+// file of the next generation, which is renamed over the old one, and that
+// rename is the only commit point: the tombstone file keeps its older
+// generation, which marks its tombstones as applied, and is replaced
+// wholesale the next time deletes are merged into it. A replacement file is
+// synced before it is renamed into place, since the file it replaces is
+// gone after the rename; plain appends are only synced by flush().
+//
+// find() binary searches the sorted prefix left by the last compaction,
+// whose length is in the header, for the key's run of values, which comes
+// out in order, and scans the unsorted tail appended since along with the
+// inserts still buffered in memory. The run is streamed to the caller with
+// the tail's values merged in, so even a key with a huge value set is never
+// collected into a set. In mmap mode the data file is read through a shared
+// mapping instead of copying it.
+class LogStorage {
+private:
+    EntryFile data_file;    // kept open for the process lifetime
+    EntryFile delete_file;
+    std::vector<Entry> pending_inserts;  // appended when full or on flush()
+    std::vector<Entry> pending_deletes;  // sorted, merged in when full or on flush()
+    std::vector<Entry> pending_cancels;  // sorted stored tombstones to drop, likewise
+    bool synced;  // nothing written since the last flush()
+    static constexpr size_t PENDING_ENTRIES = 1024;      // buffered per kind
+    static constexpr size_t COMPACT_FRACTION = 64;       // of the sorted entries
+    static constexpr size_t MIN_COMPACT_ENTRIES = 1024;  // tail and tombstones
+    static const size_t COMPACT_BUDGET = 256 * 1024;  // bytes of entries in memory
+    static const size_t MAX_FAN_IN = 16;              // chunks per merge pass
+    static const size_t MIN_READ_ENTRIES = 32;        // per chunk read while merging
+
+    // Sorted run of entries in the spill file
+    struct SpillChunk {
+        long long offset;
+        size_t count;
+    };
+
+    // Reads a sorted chunk in pieces, or walks one already in memory
+    class ChunkCursor {
+    private:
+        RandomAccessFile* file;
+        long long offset;  // of the next piece
+        size_t left;       // entries not read yet
+        std::vector<Entry> buffer;
+        size_t pos;
+
+    public:
+        ChunkCursor(RandomAccessFile* f, const SpillChunk& chunk, size_t read_entries)
+            : file(f), offset(chunk.offset), left(chunk.count), buffer(read_entries), pos(0) {
+            fill();
+        }
+
+        explicit ChunkCursor(std::vector<Entry>&& sorted)
+            : file(nullptr), offset(0), left(0), buffer(std::move(sorted)), pos(0) {}
+
+        bool valid() const {
+            return pos < buffer.size();
+        }
+
+        const Entry& entry() const {
+            return buffer[pos];
+        }
+
+        void next() {
+            if (++pos == buffer.size() && left > 0) {
+                fill();
+            }
+        }
+
+    private:
+        void fill() {
+            size_t n = std::min(left, buffer.capacity());
+            buffer.resize(n);
+            file->read_at(offset, buffer.data(), n * sizeof(Entry));
+            offset += n * sizeof(Entry);
+            left -= n;
+            pos = 0;
+        }
+    };
+
+    // Merges sorted cursors into one ascending stream without duplicates
+    class MergeStream {
+    private:
+        std::vector<ChunkCursor>& cursors;
+        int best;
+
+    public:
+        explicit MergeStream(std::vector<ChunkCursor>& c) : cursors(c), best(-1) {
+            select();
+        }
+
+        bool valid() const {
+            return best >= 0;
+        }
+
+        const Entry& entry() const {
+            return cursors[best].entry();
+        }
+
+        void next() {
+            Entry current = entry();
+            for (auto& cursor : cursors) {
+                while (cursor.valid() && cursor.entry() == current) cursor.next();
+            }
+            select();
+        }
+
+    private:
+        void select() {
+            best = -1;
+            for (size_t i = 0; i < cursors.size(); i++) {
+                if (cursors[i].valid() && (best < 0 || cursors[i].entry() < cursors[best].entry())) {
+                    best = i;
+                }
+            }
+        }
+    };
+
+    bool use_mmap;
+    MemoryMap data_map;
+
+public:
+    LogStorage(const std::string& fname, bool mmap_reads = false)
+        : data_file(fname),
+          delete_file(fname + ".deleted"),
+          synced(true),
+          use_mmap(mmap_reads) {
+        // Appends stay buffered until full or flush()
+        pending_inserts.reserve(PENDING_ENTRIES);
+        pending_deletes.reserve(PENDING_ENTRIES);
+        pending_cancels.reserve(PENDING_ENTRIES);
+    }
+
+    ~LogStorage() {
+        flush();
+    }
+
+    void insert(std::string_view key, int value) {
+        // Use append-only approach for better performance
+        Entry inserted(key, value);
+        cancel_tombstone(inserted);
+        pending_inserts.push_back(inserted);
+        if (pending_inserts.size() >= PENDING_ENTRIES) {
+            append(data_file, pending_inserts);
+        }
+        if (pending_cancels.size() >= PENDING_ENTRIES) {
+            merge_deletes();
+        }
+        maybe_compact();
+    }
+
+    void remove(std::string_view key, int value) {
+        // Mark entry as deleted in the tombstone file on the next flush
+        Entry deleted(key, value);
+        auto it = std::lower_bound(pending_deletes.begin(), pending_deletes.end(), deleted);
+        if (it == pending_deletes.end() || !(*it == deleted)) {
+            pending_deletes.insert(it, deleted);
+        }
+        // A stored tombstone of the pair applies again
+        it = std::lower_bound(pending_cancels.begin(), pending_cancels.end(), deleted);
+        if (it != pending_cancels.end() && *it == deleted) {
+            pending_cancels.erase(it);
+        }
+        if (pending_deletes.size() >= PENDING_ENTRIES) {
+            merge_deletes();
+        }
+        maybe_compact();
+    }
+
+    // Make every operation so far durable: the caller's write-ahead log is
+    // dropped once this returns
+    void flush() {
+        append(data_file, pending_inserts);
+        merge_deletes();
+        if (!synced) {
+            data_file.sync();
+            delete_file.sync();
+            sync_directory_of(data_file.name());
+            synced = true;
+        }
+    }
+
+    std::vector<int> find(std::string_view key) {
+        ValueCollector values;
+        find_into(key, values);
+        return std::move(values.values);
+    }
+
+    // Pass the values of key to sink, ascending: the key's run in the
+    // sorted prefix, merged with the few entries appended or buffered since
+    // and less its tombstones, goes out STREAM_VALUES at a time
+    void find_into(std::string_view key, ValueSink& sink) {
+        Entry low(key, -1);  // Values are non-negative
+        ArenaVector<int> deleted = deleted_values(low);
+        ArenaVector<int> tail;
+        for (const Entry& entry : pending_inserts) {
+            if (entry.same_key(low)) tail.push_back(entry.value);
+        }
+
+        if (use_mmap) {
+            // Extend the mapping over blocks appended since the last find
+            data_map.remap(data_file.raw());
+            for (size_t id = data_file.sorted_blocks(); id < data_file.block_count(); id++) {
+                const EntryFile::Block* block = mapped_block(id);
+                for (const Entry* it = block->entries; it != block->entries + block->count; ++it) {
+                    if (it->same_key(low)) tail.push_back(it->value);
+                }
+            }
+            stream_values(low, tail, deleted, sink, [&](size_t i) -> const Entry& {
+                return mapped_block(i / EntryFile::BLOCK_ENTRIES)->entries[i % EntryFile::BLOCK_ENTRIES];
+            });
+        } else {
+            ArenaVector<Entry> appended;
+            for (size_t id = data_file.sorted_blocks(); id < data_file.block_count();) {
+                appended.clear();
+                id += data_file.read_blocks(id, EntryFile::READ_BLOCKS, appended);
+                for (const Entry& entry : appended) {
+                    if (entry.same_key(low)) tail.push_back(entry.value);
+                }
+            }
+            stream_values(low, tail, deleted, sink, [&](size_t i) -> const Entry& { return data_file.at(i); });
+        }
+    }
+
+private:
+    static const size_t STREAM_VALUES = 1024;
+
+    const EntryFile::Block* mapped_block(size_t id) {
+        auto block = reinterpret_cast<const EntryFile::Block*>(data_map.data() + EntryFile::offset_of(id));
+        data_file.check(id, *block);
+        return block;
+    }
+
+    // Merge low's run in the sorted prefix, read through entry_at, with its
+    // appended values in tail, skipping duplicates and deleted values
+    template <class EntryAt>
+    void stream_values(const Entry& low, ArenaVector<int>& tail, const ArenaVector<int>& deleted, ValueSink& sink,
+                       EntryAt entry_at) {
+        std::sort(tail.begin(), tail.end());
+        size_t sorted_count = data_file.sorted_count();
+        size_t lo = 0, hi = sorted_count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (entry_at(mid) < low) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        ArenaVector<int> buffer;
+        buffer.reserve(STREAM_VALUES);
+        auto emit = [&](int value) {
+            if ((!buffer.empty() && buffer.back() == value) ||
+                std::binary_search(deleted.begin(), deleted.end(), value)) {
+                return;
+            }
+            if (buffer.size() == STREAM_VALUES) {
+                int last = buffer.back();
+                sink.put(buffer.data(), buffer.size());
+                buffer.clear();
+                if (last == value) return;
+            }
+            buffer.push_back(value);
+        };
+        auto next_tail = tail.begin();
+        for (; lo < sorted_count; lo++) {
+            const Entry& entry = entry_at(lo);
+            if (!entry.same_key(low)) break;
+            int value = entry.value;
+            for (; next_tail != tail.end() && *next_tail <= value; ++next_tail) emit(*next_tail);
+            emit(value);
+        }
+        for (; next_tail != tail.end(); ++next_tail) emit(*next_tail);
+        sink.put(buffer.data(), buffer.size());
+    }
+
+    // Binary search the tombstone file, sorted throughout, for the first
+    // entry >= low
+    size_t lower_tombstone(const Entry& low) {
+        size_t lo = 0, hi = stored_deletes();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (delete_file.at(mid) < low) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Drop the tombstone of a pair inserted again, pending or stored: every
+    // copy of the pair in the data file, old or new, is live from now on
+    void cancel_tombstone(const Entry& entry) {
+        auto it = std::lower_bound(pending_deletes.begin(), pending_deletes.end(), entry);
+        if (it != pending_deletes.end() && *it == entry) {
+            pending_deletes.erase(it);
+        }
+
+        size_t at = lower_tombstone(entry);
+        if (at < stored_deletes() && delete_file.at(at) == entry) {
+            it = std::lower_bound(pending_cancels.begin(), pending_cancels.end(), entry);
+            if (it == pending_cancels.end() || !(*it == entry)) {
+                pending_cancels.insert(it, entry);
+            }
+        }
+    }
+
+    bool cancelled(const Entry& entry) const {
+        return std::binary_search(pending_cancels.begin(), pending_cancels.end(), entry);
+    }
+
+    // Values of low's key with a tombstone, ascending
+    ArenaVector<int> deleted_values(const Entry& low) {
+        ArenaVector<int> values;
+        size_t count = stored_deletes();
+        for (size_t lo = lower_tombstone(low); lo < count && delete_file.at(lo).same_key(low); lo++) {
+            if (!cancelled(delete_file.at(lo))) values.push_back(delete_file.at(lo).value);
+        }
+
+        auto it = std::lower_bound(pending_deletes.begin(), pending_deletes.end(), low);
+        for (; it != pending_deletes.end() && it->same_key(low); ++it) {
+            values.push_back(it->value);
+        }
+
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+
+    // Replace the tombstone file, in the data file's generation, with its
+    // stored tombstones less the cancelled ones merged with the pending
+    // deletes. The stored ones are read and written READ_BLOCKS at a time.
+    void merge_deletes() {
+        if (pending_deletes.empty() && pending_cancels.empty()) {
+            return;
+        }
+        size_t stored_blocks = stored_deletes() > 0 ? delete_file.sorted_blocks() : 0;
+        EntryFile out = EntryFile::create(delete_file.name() + ".tmp");
+        size_t out_entries = EntryFile::READ_BLOCKS * EntryFile::BLOCK_ENTRIES;  // whole blocks
+        std::vector<Entry> stored, buffer;
+        buffer.reserve(out_entries);
+        size_t next_block = 0, pos = 0, written = 0;
+        auto pending = pending_deletes.begin();
+        for (;;) {
+            while (pos == stored.size() && next_block < stored_blocks) {
+                stored.clear();
+                pos = 0;
+                next_block += delete_file.read_blocks(next_block, EntryFile::READ_BLOCKS, stored);
+            }
+            bool have_stored = pos < stored.size();
+            bool have_pending = pending != pending_deletes.end();
+            if (!have_stored && !have_pending) break;
+
+            const Entry* next;
+            if (have_stored && (!have_pending || !(*pending < stored[pos]))) {
+                next = &stored[pos++];
+                if (have_pending && *pending == *next) {
+                    ++pending;
+                } else if (cancelled(*next)) {
+                    continue;
+                }
+            } else {
+                next = &*pending++;
+            }
+            buffer.push_back(*next);
+            if (buffer.size() == out_entries) {
+                written += buffer.size();
+                append(out, buffer);
+            }
+        }
+        written += buffer.size();
+        append(out, buffer);
+
+        out.commit(data_file.generation(), written, delete_file.name());
+        delete_file = std::move(out);
+        synced = false;
+        pending_deletes.clear();
+        pending_cancels.clear();
+    }
+
+    // Tombstones in the file that are not applied to the data file yet
+    size_t stored_deletes() const {
+        return delete_file.generation() == data_file.generation() ? delete_file.sorted_count() : 0;
+    }
+
+    void append(EntryFile& file, std::vector<Entry>& pending) {
+        if (pending.empty()) {
+            return;
+        }
+        file.append(pending.data(), pending.size());
+        pending.clear();
+        synced = false;
+    }
+
+    // Compact once the entries a find has to scan or filter, the unsorted
+    // tail and the tombstones, grow past a fixed share of the sorted ones
+    void maybe_compact() {
+        size_t tail = data_file.tail_count() + pending_inserts.size();
+        size_t tombstones = stored_deletes() + pending_deletes.size();
+        size_t limit = std::max(MIN_COMPACT_ENTRIES, data_file.sorted_count() / COMPACT_FRACTION);
+        if (tail + tombstones >= limit) {
+            compact_files();
+        }
+    }
+
+    void compact_files() {
+        // Pending deletes go straight into the merge, not the tombstone file
+        append(data_file, pending_inserts);
+
+        size_t data_count = data_file.block_count() * EntryFile::BLOCK_ENTRIES;
+        size_t deleted_count = stored_deletes() + pending_deletes.size();
+        EntryFile out = EntryFile::create(data_file.name() + ".tmp");
+        size_t written;
+        if ((data_count + deleted_count) * sizeof(Entry) <= COMPACT_BUDGET) {
+            std::vector<ChunkCursor> live, deleted;
+            live.emplace_back(sorted_entries(data_file));
+            if (stored_deletes() > 0) {
+                deleted.emplace_back(delete_file.read_all());
+            }
+            deleted.emplace_back(std::move(pending_deletes));
+            written = merge_into(out, live, deleted);
+        } else {
+            std::string spill_name = data_file.name() + ".spill";
+            {
+                RandomAccessFile spill(spill_name);
+                spill.truncate(0);
+                long long spill_end = 0;
+                std::vector<SpillChunk> live = spill_sorted(data_file, spill, spill_end);
+                std::vector<SpillChunk> deleted;
+                if (stored_deletes() > 0) {
+                    deleted = spill_sorted(delete_file, spill, spill_end);
+                }
+                reduce_chunks(spill, spill_end, live);
+                reduce_chunks(spill, spill_end, deleted);
+
+                // One read buffer per chunk plus the output buffer share the budget
+                size_t read_entries = read_entries_for(live.size() + deleted.size() + 1);
+                std::vector<ChunkCursor> live_cursors, deleted_cursors;
+                for (const auto& chunk : live) live_cursors.emplace_back(&spill, chunk, read_entries);
+                for (const auto& chunk : deleted) deleted_cursors.emplace_back(&spill, chunk, read_entries);
+                deleted_cursors.emplace_back(std::move(pending_deletes));
+                written = merge_into(out, live_cursors, deleted_cursors);
+            }
+            std::remove(spill_name.c_str());
+        }
+
+        // The commit point: from here on the tombstone file is of an older
+        // generation than the data
+        out.commit(data_file.generation() + 1, written, data_file.name());
+        data_file = std::move(out);
+        synced = false;
+        pending_deletes.clear();
+        pending_deletes.reserve(PENDING_ENTRIES);
+        pending_cancels.clear();
+
+        if (use_mmap) {
+            // The mapping is of the file just replaced
+            data_map.unmap();
+        }
+    }
+
+    static size_t read_entries_for(size_t buffers) {
+        size_t entries = COMPACT_BUDGET / sizeof(Entry) / buffers;
+        return entries > MIN_READ_ENTRIES ? entries : MIN_READ_ENTRIES;
+    }
+
+    std::vector<Entry> sorted_entries(EntryFile& file) {
+        std::vector<Entry> entries = file.read_all();
+        std::sort(entries.begin(), entries.end());
+        return entries;
+    }
+
+    // Cut file into budget-sized chunks, sort each and append it to spill
+    std::vector<SpillChunk> spill_sorted(EntryFile& file, RandomAccessFile& spill, long long& spill_end) {
+        std::vector<SpillChunk> chunks;
+        std::vector<Entry> buffer;
+        size_t chunk_blocks = COMPACT_BUDGET / EntryFile::BLOCK_BYTES;
+        buffer.reserve(chunk_blocks * EntryFile::BLOCK_ENTRIES);
+        for (size_t block = 0;;) {
+            buffer.clear();
+            size_t got = file.read_blocks(block, chunk_blocks, buffer);
+            if (got == 0) break;
+            block += got;
+
+            std::sort(buffer.begin(), buffer.end());
+            size_t count = std::unique(buffer.begin(), buffer.end()) - buffer.begin();
+            spill.write_at(spill_end, buffer.data(), count * sizeof(Entry));
+            chunks.push_back({spill_end, count});
+            spill_end += count * sizeof(Entry);
+        }
+        return chunks;
+    }
+
+    // Merge chunks MAX_FAN_IN at a time until at most MAX_FAN_IN are left
+    void reduce_chunks(RandomAccessFile& spill, long long& spill_end, std::vector<SpillChunk>& chunks) {
+        while (chunks.size() > MAX_FAN_IN) {
+            std::vector<SpillChunk> merged;
+            for (size_t first = 0; first < chunks.size(); first += MAX_FAN_IN) {
+                size_t last = std::min(first + MAX_FAN_IN, chunks.size());
+                size_t read_entries = read_entries_for(last - first + 1);
+                std::vector<ChunkCursor> cursors;
+                for (size_t i = first; i < last; i++) {
+                    cursors.emplace_back(&spill, chunks[i], read_entries);
+                }
+
+                SpillChunk out = {spill_end, 0};
+                std::vector<Entry> buffer;
+                buffer.reserve(read_entries);
+                for (MergeStream stream(cursors); stream.valid(); stream.next()) {
+                    buffer.push_back(stream.entry());
+                    if (buffer.size() == read_entries) {
+                        write_out(spill, spill_end, buffer);
+                    }
+                }
+                write_out(spill, spill_end, buffer);
+                out.count = (spill_end - out.offset) / sizeof(Entry);
+                merged.push_back(out);
+            }
+            chunks.swap(merged);
+        }
+    }
+
+    // Write the live entries to out, dropping every one with a tombstone
+    // that is not cancelled; returns the number written
+    size_t merge_into(EntryFile& out, std::vector<ChunkCursor>& live, std::vector<ChunkCursor>& deleted) {
+        // Whole blocks per write, so the output is sorted in full blocks
+        size_t out_entries = read_entries_for(live.size() + deleted.size() + 1);
+        out_entries = std::max<size_t>(1, out_entries / EntryFile::BLOCK_ENTRIES) * EntryFile::BLOCK_ENTRIES;
+        std::vector<Entry> buffer;
+        buffer.reserve(out_entries);
+        size_t written = 0;
+
+        MergeStream tombstones(deleted);
+        for (MergeStream stream(live); stream.valid(); stream.next()) {
+            const Entry& entry = stream.entry();
+            while (tombstones.valid() && tombstones.entry() < entry) tombstones.next();
+            if (tombstones.valid() && tombstones.entry() == entry && !cancelled(entry)) continue;
+
+            buffer.push_back(entry);
+            if (buffer.size() == out_entries) {
+                written += buffer.size();
+                append(out, buffer);
+            }
+        }
+        written += buffer.size();
+        append(out, buffer);
+        return written;
+    }
+
+    static void write_out(RandomAccessFile& file, long long& end, std::vector<Entry>& buffer) {
+        file.write_at(end, buffer.data(), buffer.size() * sizeof(Entry));
+        end += buffer.size() * sizeof(Entry);
+        buffer.clear();
+    }
+};
+
+#endif  // LOG_STORAGE_HPP
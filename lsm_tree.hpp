@@ -0,0 +1,600 @@
+#ifndef LSM_TREE_HPP
+#define LSM_TREE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "bloom_filter.hpp"
+#include "file_io.hpp"
+#include "storage_engine.hpp"
+
+// One (key, value) record of a sorted run: a put or a tombstone
+struct RunCell {
+    unsigned char len;
+    unsigned char live;  // 0 for a tombstone
+    char key[64];
+    int value;
+
+    int compare_key(const char* k, size_t n) const {
+        int cmp = memcmp(key, k, std::min<size_t>(len, n));
+        if (cmp != 0) return cmp;
+        return len < n ? -1 : (len > n ? 1 : 0);
+    }
+
+    bool operator<(const RunCell& other) const {
+        int cmp = compare_key(other.key, other.len);
+        if (cmp != 0) return cmp < 0;
+        return value < other.value;
+    }
+
+    bool same_record(const RunCell& other) const {
+        return value == other.value && compare_key(other.key, other.len) == 0;
+    }
+};
+
+// Immutable sorted run file:
+//   [block 0] ... [block n-1] [index] [filter] [footer]
+// Blocks are BLOCK_BYTES each, starting with a uint16 record count and
+// holding records [len:1][key][value:4][live:1] that never straddle blocks.
+// The index holds the first key of every block as [len:1][key]; the filter
+// is a Bloom filter over every key in the run. An open run keeps both in
+// the arena, so they count against the memory cap.
+class SortedRun {
+public:
+    static const int BLOCK_BYTES = 4096;
+    static const uint32_t MAGIC = 0x4c534d31;  // "LSM1"
+
+    struct Footer {
+        uint32_t magic;
+        int block_count;
+        int index_bytes;
+        int filter_bytes;
+        int filter_probes;
+        long long record_count;
+    };
+
+    // Streams the records of a run in order, one block in memory at a time
+    class Cursor {
+    private:
+        SortedRun* run;
+        ArenaVector<char> block;
+        int block_id;
+        int remaining;  // records left in the current block
+        const char* p;
+        RunCell current;
+        bool valid_;
+
+    public:
+        explicit Cursor(SortedRun* r, int first_block = 0)
+            : run(r), block(BLOCK_BYTES), block_id(first_block - 1), remaining(0),
+              p(nullptr), valid_(true) {
+            next();
+        }
+
+        bool valid() const {
+            return valid_;
+        }
+
+        const RunCell& cell() const {
+            return current;
+        }
+
+        void next() {
+            while (remaining == 0) {
+                if (++block_id >= run->footer.block_count) {
+                    valid_ = false;
+                    return;
+                }
+                run->read_block(block_id, block.data());
+                uint16_t count;
+                memcpy(&count, block.data(), sizeof(count));
+                remaining = count;
+                p = block.data() + sizeof(uint16_t);
+            }
+            p = decode(p, current);
+            remaining--;
+        }
+    };
+
+private:
+    RandomAccessFile file;
+    int run_seq;
+    int run_tier;
+    Footer footer;
+    ArenaVector<ArenaString> first_keys;  // of every block
+    ArenaVector<char> filter;
+    size_t arena_bytes;
+
+public:
+    SortedRun(const std::string& fname, int seq, int tier) : file(fname), run_seq(seq), run_tier(tier) {
+        long long size = file.size();
+        if (size < static_cast<long long>(sizeof(Footer)) ||
+            file.read_at(size - sizeof(Footer), &footer, sizeof(Footer)) != sizeof(Footer) ||
+            footer.magic != MAGIC) {
+            throw std::runtime_error("bad sorted run " + fname);
+        }
+
+        long long offset = static_cast<long long>(footer.block_count) * BLOCK_BYTES;
+        std::vector<char> index(footer.index_bytes);
+        file.read_at(offset, index.data(), index.size());
+        for (size_t i = 0; i < index.size(); i += 1 + static_cast<unsigned char>(index[i])) {
+            first_keys.emplace_back(index.data() + i + 1, static_cast<unsigned char>(index[i]));
+        }
+
+        filter.resize(footer.filter_bytes);
+        file.read_at(offset + footer.index_bytes, filter.data(), filter.size());
+
+        arena_bytes = filter.capacity() + first_keys.capacity() * sizeof(ArenaString);
+        for (const auto& key : first_keys) {
+            arena_bytes += key.capacity() + 1;
+        }
+    }
+
+    int seq() const {
+        return run_seq;
+    }
+
+    int tier() const {
+        return run_tier;
+    }
+
+    long long record_count() const {
+        return footer.record_count;
+    }
+
+    const std::string& name() const {
+        return file.name();
+    }
+
+    // Arena bytes held for this run: block index and filter
+    size_t memory_bytes() const {
+        return arena_bytes;
+    }
+
+    // Cursor at the first record of key, or at the first record after it;
+    // one that is not valid() if the filter rules the key out
+    Cursor seek(const char* key, size_t len, uint64_t hash) {
+        if (!BloomFilter::may_contain(filter.data(), filter.size(), footer.filter_probes, hash)) {
+            return Cursor(this, footer.block_count);
+        }
+
+        // Records of key start in the last block whose first key sorts
+        // before it, or in the first block
+        std::string_view k(key, len);
+        int b = std::lower_bound(first_keys.begin(), first_keys.end(), k) - first_keys.begin();
+        Cursor cursor(this, b > 0 ? b - 1 : 0);
+        while (cursor.valid() && cursor.cell().compare_key(key, len) < 0) {
+            cursor.next();
+        }
+        return cursor;
+    }
+
+    static const char* decode(const char* p, RunCell& cell) {
+        cell.len = p[0];
+        memcpy(cell.key, p + 1, cell.len);
+        memcpy(&cell.value, p + 1 + cell.len, sizeof(int));
+        cell.live = p[1 + cell.len + sizeof(int)];
+        return p + 2 + cell.len + sizeof(int);
+    }
+
+    static size_t encoded_bytes(const RunCell& cell) {
+        return 2 + cell.len + sizeof(int);
+    }
+
+    static char* encode(char* p, const RunCell& cell) {
+        p[0] = cell.len;
+        memcpy(p + 1, cell.key, cell.len);
+        memcpy(p + 1 + cell.len, &cell.value, sizeof(int));
+        p[1 + cell.len + sizeof(int)] = cell.live;
+        return p + 2 + cell.len + sizeof(int);
+    }
+
+private:
+    void read_block(int id, char* buf) {
+        file.read_at(static_cast<long long>(id) * BLOCK_BYTES, buf, BLOCK_BYTES);
+    }
+};
+
+// Writes a new sorted run from records added in order
+class RunBuilder {
+private:
+    RandomAccessFile file;
+    std::vector<char> block;
+    char* p;
+    uint16_t block_records;
+    SortedRun::Footer footer;
+    std::vector<char> index;
+    ArenaVector<char> filter;
+
+public:
+    // max_records sizes the filter; it only has to be an upper bound
+    RunBuilder(const std::string& fname, long long max_records, int bits_per_key)
+        : file(fname), block(SortedRun::BLOCK_BYTES), block_records(0) {
+        file.truncate(0);  // May be left over from an interrupted run
+        p = block.data() + sizeof(uint16_t);
+        footer = {SortedRun::MAGIC, 0, 0, 0, BloomFilter::probes_for(bits_per_key), 0};
+        if (bits_per_key > 0) {
+            filter.assign(BloomFilter::bytes_for(std::max(max_records, 1LL), bits_per_key), 0);
+        }
+    }
+
+    void add(const RunCell& cell) {
+        if (p + SortedRun::encoded_bytes(cell) > block.data() + block.size()) {
+            finish_block();
+        }
+        if (block_records == 0) {
+            index.push_back(cell.len);
+            index.insert(index.end(), cell.key, cell.key + cell.len);
+        }
+        p = SortedRun::encode(p, cell);
+        block_records++;
+        footer.record_count++;
+        if (!filter.empty()) {
+            BloomFilter::add(filter.data(), filter.size(), footer.filter_probes,
+                             BloomFilter::hash(cell.key, cell.len));
+        }
+    }
+
+    long long record_count() const {
+        return footer.record_count;
+    }
+
+    // Write index, filter and footer and sync the run; returns the bytes
+    // written in total
+    long long finish() {
+        if (block_records > 0) {
+            finish_block();
+        }
+        long long offset = static_cast<long long>(footer.block_count) * SortedRun::BLOCK_BYTES;
+        footer.index_bytes = index.size();
+        footer.filter_bytes = filter.size();
+        file.write_at(offset, index.data(), index.size());
+        file.write_at(offset + index.size(), filter.data(), filter.size());
+        file.write_at(offset + index.size() + filter.size(), &footer, sizeof(footer));
+        file.sync_data();
+        return file.written_bytes();
+    }
+
+private:
+    void finish_block() {
+        memcpy(block.data(), &block_records, sizeof(block_records));
+        std::fill(p, block.data() + block.size(), 0);
+        file.write_at(static_cast<long long>(footer.block_count) * SortedRun::BLOCK_BYTES,
+                      block.data(), block.size());
+        footer.block_count++;
+        block_records = 0;
+        p = block.data() + sizeof(uint16_t);
+    }
+};
+
+// Log-structured merge tree. Inserts and deletes go to an in-memory
+// memtable; when it reaches MEMTABLE_BYTES or a quarter of the arena cap,
+// or the arena it lives in is running out of room for the indexes and
+// filters of the runs a flush and compaction would build, it is written
+// out as an immutable sorted run. The arena keeps the memtable's chunks
+// once they are reserved, so its share of the cap is fixed up front and
+// the rest is left to the runs. Deletes are
+// tombstones that shadow older runs until a compaction that produces the
+// oldest run drops them.
+//
+// Compaction is tiered: a run flushed from the memtable is in tier 0, and
+// once a tier holds TIER_FANOUT runs they are merged into one run of the
+// next tier. More than MAX_RUNS runs are merged into one, so the number of
+// files stays bounded. The manifest (fname itself) lists the live runs and
+// counts the bytes ingested and written, so the write amplification it
+// reports to Metrics covers every run of the database, not just this
+// process.
+class LsmTree {
+private:
+    static constexpr size_t MEMTABLE_BYTES = 512 * 1024;
+    static const size_t MEMTABLE_ENTRY_OVERHEAD = 80;  // map node, string, flag
+    static const int TIER_FANOUT = 4;
+    static const int MAX_RUNS = 12;
+    static const uint32_t MANIFEST_MAGIC = 0x4c534d4d;  // "LSMM"
+    static const size_t STREAM_VALUES = 1024;  // values per put() of a find
+
+    struct ManifestHeader {
+        uint32_t magic;
+        int next_seq;
+        int run_count;
+        long long ingested_bytes;
+        long long written_bytes;
+    };
+
+    struct ManifestRun {
+        int seq;
+        int tier;
+    };
+
+    std::string base_name;
+    int bits_per_key;
+    using MemtableKey = std::pair<ArenaString, int>;
+    using Memtable = std::map<MemtableKey, bool, std::less<MemtableKey>,
+                              ArenaAllocator<std::pair<const MemtableKey, bool>>>;
+
+    Memtable memtable;  // (key, value) -> live
+    size_t memtable_bytes;
+    size_t memtable_limit;
+    std::vector<std::unique_ptr<SortedRun>> runs;  // newest first
+    int next_seq;
+    long long ingested;  // encoded bytes of every insert and delete
+    long long written;   // bytes written to run files, compaction included
+
+public:
+    LsmTree(const std::string& fname, int bloom_bits_per_key = 10)
+        : base_name(fname), bits_per_key(bloom_bits_per_key), memtable_bytes(0),
+          memtable_limit(std::min(MEMTABLE_BYTES, Arena::global().capacity() / 4)),
+          next_seq(0), ingested(0), written(0) {
+        load_manifest();
+    }
+
+    ~LsmTree() {
+        flush();
+    }
+
+    void insert(std::string_view key, int value) {
+        put(key, value, true);
+    }
+
+    void remove(std::string_view key, int value) {
+        put(key, value, false);
+    }
+
+    // Write the memtable out as a run and compact if a tier filled up
+    void flush() {
+        if (memtable.empty()) {
+            return;
+        }
+
+        std::string fname = run_name(next_seq);
+        RunBuilder builder(fname, memtable.size(), bits_per_key);
+        RunCell cell;
+        for (const auto& item : memtable) {
+            // With no older run a tombstone has nothing left to shadow
+            if (!item.second && runs.empty()) continue;
+            set_cell(cell, item.first.first, item.first.second, item.second);
+            builder.add(cell);
+        }
+        written += builder.finish();
+        memtable.clear();
+        memtable_bytes = 0;
+
+        runs.insert(runs.begin(), std::make_unique<SortedRun>(fname, next_seq++, 0));
+        compact();
+        save_manifest();
+    }
+
+    std::vector<int> find(std::string_view key) {
+        ValueCollector values;
+        find_into(key, values);
+        return std::move(values.values);
+    }
+
+    // Pass the live values of key to sink, ascending, STREAM_VALUES at a
+    // time. The memtable and a cursor into every run that may hold the key
+    // are merged by value, and the newest record of each value decides
+    // whether it is live.
+    void find_into(std::string_view key, ValueSink& sink) {
+        ArenaString k(key.substr(0, 64));
+        auto mem = memtable.lower_bound({k, INT32_MIN});
+        auto mem_has_key = [&] { return mem != memtable.end() && mem->first.first == k; };
+
+        uint64_t hash = BloomFilter::hash(k.data(), k.size());
+        ArenaVector<SortedRun::Cursor> cursors;  // newest first, like runs
+        cursors.reserve(runs.size());
+        for (auto& run : runs) {
+            SortedRun::Cursor cursor = run->seek(k.data(), k.size(), hash);
+            if (cursor.valid() && cursor.cell().compare_key(k.data(), k.size()) == 0) {
+                cursors.push_back(std::move(cursor));
+            }
+        }
+        auto has_key = [&](const SortedRun::Cursor& c) {
+            return c.valid() && c.cell().compare_key(k.data(), k.size()) == 0;
+        };
+
+        ArenaVector<int> buffer;
+        buffer.reserve(STREAM_VALUES);
+        for (;;) {
+            // The smallest value left; of the sources holding it, the
+            // newest comes first and decides
+            bool found = false;
+            int value = 0;
+            bool live = false;
+            if (mem_has_key()) {
+                found = true;
+                value = mem->first.second;
+                live = mem->second;
+            }
+            for (const auto& cursor : cursors) {
+                if (has_key(cursor) && (!found || cursor.cell().value < value)) {
+                    found = true;
+                    value = cursor.cell().value;
+                    live = cursor.cell().live != 0;
+                }
+            }
+            if (!found) {
+                break;
+            }
+
+            if (mem_has_key() && mem->first.second == value) ++mem;
+            for (auto& cursor : cursors) {
+                if (has_key(cursor) && cursor.cell().value == value) cursor.next();
+            }
+            if (live) {
+                if (buffer.size() == STREAM_VALUES) {
+                    sink.put(buffer.data(), buffer.size());
+                    buffer.clear();
+                }
+                buffer.push_back(value);
+            }
+        }
+        sink.put(buffer.data(), buffer.size());
+    }
+
+private:
+    void put(std::string_view key, int value, bool live) {
+        ArenaString k(key.substr(0, 64));
+        auto result = memtable.insert({{k, value}, live});
+        if (result.second) {
+            memtable_bytes += k.size() + MEMTABLE_ENTRY_OVERHEAD;
+        } else {
+            result.first->second = live;
+        }
+        ingested += 2 + k.size() + sizeof(int);
+
+        if (memtable_bytes >= memtable_limit || !Arena::global().can_grow(flush_headroom())) {
+            flush();
+        }
+    }
+
+    // Arena bytes a flush may need beyond what the memtable frees: the new
+    // run's filter and index and, for a compaction, a second copy of those
+    // of every run
+    size_t flush_headroom() const {
+        size_t bytes = BloomFilter::bytes_for(memtable.size() + 1, bits_per_key) * 2;
+        for (const auto& run : runs) {
+            bytes += 2 * run->memory_bytes();
+        }
+        return bytes;
+    }
+
+    std::string run_name(int seq) const {
+        return base_name + ".run" + std::to_string(seq);
+    }
+
+    static void set_cell(RunCell& cell, std::string_view key, int value, bool live) {
+        cell.len = key.size();
+        memcpy(cell.key, key.data(), cell.len);
+        cell.value = value;
+        cell.live = live;
+    }
+
+    void compact() {
+        for (int tier = 0;; tier++) {
+            int count = 0;
+            bool deeper = false;
+            for (const auto& run : runs) {
+                if (run->tier() == tier) count++;
+                if (run->tier() > tier) deeper = true;
+            }
+            if (count >= TIER_FANOUT) {
+                merge_tier(tier, tier + 1);
+            } else if (!deeper) {
+                break;
+            }
+        }
+        if (static_cast<int>(runs.size()) > MAX_RUNS) {
+            merge_tier(-1, runs.back()->tier() + 1);
+        }
+    }
+
+    // Merge every run of tier (every run if tier is -1) into one run of
+    // out_tier. Runs of a tier are contiguous in newest-first order.
+    void merge_tier(int tier, int out_tier) {
+        size_t first = 0;
+        while (first < runs.size() && tier != -1 && runs[first]->tier() != tier) first++;
+        size_t last = first;
+        long long max_records = 0;
+        while (last < runs.size() && (tier == -1 || runs[last]->tier() == tier)) {
+            max_records += runs[last++]->record_count();
+        }
+        bool oldest = last == runs.size();
+
+        std::vector<SortedRun::Cursor> cursors;
+        cursors.reserve(last - first);
+        for (size_t i = first; i < last; i++) {
+            cursors.emplace_back(runs[i].get());
+        }
+
+        std::string fname = run_name(next_seq);
+        RunBuilder builder(fname, max_records, bits_per_key);
+        for (;;) {
+            // Smallest record; on ties the newest run (lowest index) wins
+            int best = -1;
+            for (size_t i = 0; i < cursors.size(); i++) {
+                if (cursors[i].valid() && (best < 0 || cursors[i].cell() < cursors[best].cell())) {
+                    best = i;
+                }
+            }
+            if (best < 0) break;
+
+            RunCell cell = cursors[best].cell();
+            for (auto& cursor : cursors) {
+                if (cursor.valid() && cursor.cell().same_record(cell)) cursor.next();
+            }
+            if (cell.live || !oldest) {
+                builder.add(cell);
+            }
+        }
+        written += builder.finish();
+
+        std::vector<std::string> dropped;
+        for (size_t i = first; i < last; i++) {
+            dropped.push_back(runs[i]->name());
+        }
+        runs.erase(runs.begin() + first, runs.begin() + last);
+        runs.insert(runs.begin() + first, std::make_unique<SortedRun>(fname, next_seq++, out_tier));
+
+        // The inputs are only garbage once the manifest no longer lists them
+        save_manifest();
+        for (const auto& name : dropped) {
+            std::remove(name.c_str());
+        }
+    }
+
+    void load_manifest() {
+        RandomAccessFile manifest(base_name);
+        if (manifest.size() == 0) {
+            return;  // Fresh database
+        }
+
+        ManifestHeader header;
+        if (manifest.read_at(0, &header, sizeof(header)) != sizeof(header) ||
+            header.magic != MANIFEST_MAGIC) {
+            throw std::runtime_error("bad manifest " + base_name);
+        }
+        std::vector<ManifestRun> listed(header.run_count);
+        manifest.read_at(sizeof(header), listed.data(), listed.size() * sizeof(ManifestRun));
+
+        next_seq = header.next_seq;
+        ingested = header.ingested_bytes;
+        written = header.written_bytes;
+        for (const auto& run : listed) {
+            runs.push_back(std::make_unique<SortedRun>(run_name(run.seq), run.seq, run.tier));
+        }
+    }
+
+    // Replace the manifest by writing a new one, syncing it and renaming it
+    // into place
+    void save_manifest() {
+        ManifestHeader header = {MANIFEST_MAGIC, next_seq, static_cast<int>(runs.size()),
+                                 ingested, written};
+        std::vector<ManifestRun> listed;
+        for (const auto& run : runs) {
+            listed.push_back({run->seq(), run->tier()});
+        }
+
+        std::string tmp_name = base_name + ".tmp";
+        {
+            RandomAccessFile tmp(tmp_name);
+            tmp.truncate(0);
+            tmp.write_at(0, &header, sizeof(header));
+            tmp.write_at(sizeof(header), listed.data(), listed.size() * sizeof(ManifestRun));
+            tmp.sync();
+        }
+        replace_file(tmp_name, base_name);
+        if (Metrics* m = Metrics::active()) m->write_amplification(ingested, written);
+    }
+};
+
+#endif  // LSM_TREE_HPP
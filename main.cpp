@@ -1,206 +1,118 @@
-#include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
-#include <algorithm>
-#include <cstring>
-#include <set>
 
-using namespace std;
-
-// Structure to store key-value pair
-struct Entry {
-    char key[65];  // 64 bytes + null terminator
-    int value;
+#include "block_list.hpp"
+#include "bplus_tree.hpp"
+#include "command_loop.hpp"
+#include "log_storage.hpp"
+#include "lsm_tree.hpp"
+#include "storage_engine.hpp"
+#include "wal.hpp"
 
-    bool operator<(const Entry& other) const {
-        int key_cmp = strcmp(key, other.key);
-        if (key_cmp != 0) return key_cmp < 0;
-        return value < other.value;
-    }
+using namespace std;
 
-    bool operator==(const Entry& other) const {
-        return strcmp(key, other.key) == 0 && value == other.value;
-    }
+// Storage backends FileStorage can run on
+enum class Backend {
+    Log,        // append log + tombstone file, periodically compacted
+    MappedLog,  // Log with finds served from a memory mapping of data.db
+    BlockList,  // sorted fixed-size blocks with an in-memory block index
+    BPlusTree,  // paged B+ tree with a bounded page cache
+    Lsm         // memtable + sorted runs with tiered compaction
 };
 
-class FileStorage {
+class FileStorage : public StorageEngine {
 private:
-    string filename;
-    string delete_filename;
-    int operation_count;
-    static const int COMPACT_THRESHOLD = 50;
+    using Engine = variant<LogStorage, BlockList, BPlusTree, LsmTree>;
 
-public:
-    FileStorage(const string& fname) : filename(fname),
-                                       delete_filename(fname + ".deleted"),
-                                       operation_count(0) {
-        // Create files if they don't exist
-        ofstream file(filename, ios::binary | ios::app);
-        file.close();
-        ofstream dfile(delete_filename, ios::binary | ios::app);
-        dfile.close();
-    }
+    static constexpr size_t WAL_GROUP_BYTES = 64 * 1024;
+    static const long long CHECKPOINT_BYTES = 4 * 1024 * 1024;
+    static constexpr int BLOOM_BITS_PER_KEY = 10;  // BlockList blocks, LsmTree runs
 
-    void insert(const string& key, int value) {
-        Entry new_entry;
-        strncpy(new_entry.key, key.c_str(), 64);
-        new_entry.key[64] = '\0';
-        new_entry.value = value;
-
-        // Use append-only approach for better performance
-        ofstream file(filename, ios::binary | ios::app);
-        file.write(reinterpret_cast<char*>(&new_entry), sizeof(Entry));
-        file.close();
-
-        operation_count++;
-        if (operation_count >= COMPACT_THRESHOLD) {
-            compact_files();
-            operation_count = 0;
+    Engine engine;
+    // Every backend holds changes in memory between flushes: Log and Lsm
+    // buffer operations, BlockList and BPlusTree dirty pages in their pools
+    WriteAheadLog wal;
+
+public:
+    FileStorage(const string& fname, Backend backend = Backend::BlockList)
+        : engine(make_engine(fname, backend)), wal(fname + ".wal", WAL_GROUP_BYTES) {
+        // Recover operations a previous run logged but never checkpointed.
+        // Replaying is safe over any mix of them already in the files: each
+        // sets a pair present or absent, and the last one on a pair wins.
+        if (wal.size() > 0) {
+            wal.replay([&](WriteAheadLog::Op op, const Entry& entry) {
+                if (op == WriteAheadLog::INSERT) {
+                    visit([&](auto& e) { e.insert(entry.key, entry.value); }, engine);
+                } else {
+                    visit([&](auto& e) { e.remove(entry.key, entry.value); }, engine);
+                }
+            });
+            checkpoint();
         }
     }
 
-    void remove(const string& key, int value) {
-        // Mark entry as deleted by writing to a separate file
-        ofstream delete_file(delete_filename, ios::binary | ios::app);
+    ~FileStorage() override {
+        checkpoint();
+    }
 
-        Entry delete_entry;
-        strncpy(delete_entry.key, key.c_str(), 64);
-        delete_entry.key[64] = '\0';
-        delete_entry.value = value;
+    void insert(string_view key, int value) override {
+        wal.append(WriteAheadLog::INSERT, key, value);
+        visit([&](auto& e) { e.insert(key, value); }, engine);
+        if (wal.size() >= CHECKPOINT_BYTES) checkpoint();
+    }
 
-        delete_file.write(reinterpret_cast<char*>(&delete_entry), sizeof(Entry));
-        delete_file.close();
+    void remove(string_view key, int value) override {
+        wal.append(WriteAheadLog::REMOVE, key, value);
+        visit([&](auto& e) { e.remove(key, value); }, engine);
+        if (wal.size() >= CHECKPOINT_BYTES) checkpoint();
+    }
 
-        operation_count++;
-        if (operation_count >= COMPACT_THRESHOLD) {
-            compact_files();
-            operation_count = 0;
-        }
+    vector<int> find(string_view key) override {
+        return visit([&](auto& e) { return e.find(key); }, engine);
     }
 
-    vector<int> find(const string& key) {
-        // Read all entries from main file
-        vector<Entry> entries = read_all_entries(filename);
-
-        // Read deleted entries
-        vector<Entry> deleted_entries = read_all_entries(delete_filename);
-
-        // Use set to avoid duplicates and maintain order
-        set<int> value_set;
-        for (const auto& entry : entries) {
-            if (strcmp(entry.key, key.c_str()) == 0) {
-                // Check if this entry is deleted
-                bool is_deleted = false;
-                for (const auto& deleted : deleted_entries) {
-                    if (entry == deleted) {
-                        is_deleted = true;
-                        break;
-                    }
-                }
-                if (!is_deleted) {
-                    value_set.insert(entry.value);
-                }
-            }
-        }
+    void find_into(string_view key, ValueSink& sink) override {
+        visit([&](auto& e) { e.find_into(key, sink); }, engine);
+    }
 
-        return vector<int>(value_set.begin(), value_set.end());
+    void flush() override {
+        checkpoint();
     }
 
 private:
-    vector<Entry> read_all_entries(const string& fname) {
-        vector<Entry> entries;
-        ifstream file(fname, ios::binary);
-
-        if (!file.is_open()) {
-            return entries;
-        }
-
-        Entry entry;
-        while (file.read(reinterpret_cast<char*>(&entry), sizeof(Entry))) {
-            entries.push_back(entry);
+    static Engine make_engine(const string& fname, Backend backend) {
+        switch (backend) {
+            case Backend::Log:
+                return Engine(in_place_type<LogStorage>, fname);
+            case Backend::MappedLog:
+                return Engine(in_place_type<LogStorage>, fname, true);
+            case Backend::BPlusTree:
+                return Engine(in_place_type<BPlusTree>, fname);
+            case Backend::Lsm:
+                return Engine(in_place_type<LsmTree>, fname, BLOOM_BITS_PER_KEY);
+            case Backend::BlockList:
+            default:
+                return Engine(in_place_type<BlockList>, fname, BLOOM_BITS_PER_KEY);
         }
-        file.close();
-
-        return entries;
     }
 
-    void compact_files() {
-        // Read all entries
-        vector<Entry> all_entries = read_all_entries(filename);
-        vector<Entry> deleted_entries = read_all_entries(delete_filename);
-
-        // Create set of deleted entries for fast lookup
-        set<Entry> deleted_set(deleted_entries.begin(), deleted_entries.end());
-
-        // Filter out deleted entries
-        vector<Entry> live_entries;
-        for (const auto& entry : all_entries) {
-            if (deleted_set.find(entry) == deleted_set.end()) {
-                live_entries.push_back(entry);
-            }
-        }
-
-        // Sort live entries
-        sort(live_entries.begin(), live_entries.end());
-
-        // Remove duplicates
-        auto last = unique(live_entries.begin(), live_entries.end());
-        live_entries.erase(last, live_entries.end());
-
-        // Write back compacted file
-        ofstream file(filename, ios::binary | ios::trunc);
-        for (const auto& entry : live_entries) {
-            file.write(reinterpret_cast<const char*>(&entry), sizeof(Entry));
-        }
-        file.close();
-
-        // Clear deletion file
-        ofstream dfile(delete_filename, ios::binary | ios::trunc);
-        dfile.close();
+    // Make everything logged so far durable in the engine, then drop the
+    // log; every engine's flush() syncs what it wrote
+    void checkpoint() {
+        wal.flush();
+        visit([](auto& e) { e.flush(); }, engine);
+        wal.reset();
     }
 };
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data.db");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
-        }
-    }
+// Backend of this build; CMake builds one target per backend, and "code"
+// on the one that benchmarks best
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND BlockList
+#endif
 
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db", Backend::STORAGE_BACKEND);
+}
@@ -1,11 +1,15 @@
-#include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <cstring>
 #include <set>
 
+#include "command_loop.hpp"
+#include "file_io.hpp"
+#include "storage_engine.hpp"
+
 using namespace std;
 
 // Structure to store key-value pair
@@ -13,6 +17,18 @@ struct Entry {
     char key[65];  // 64 bytes + null terminator
     int value;
 
+    Entry() = default;
+
+    // Zeroed first: padding and the bytes after the key's NUL are written
+    // to the files too
+    Entry(string_view k, int v) {
+        memset(this, 0, sizeof(Entry));
+        value = v;
+        size_t len = min<size_t>(k.size(), 64);
+        memcpy(key, k.data(), len);
+        key[len] = '\0';
+    }
+
     bool operator<(const Entry& other) const {
         int key_cmp = strcmp(key, other.key);
         if (key_cmp != 0) return key_cmp < 0;
@@ -24,12 +40,19 @@ struct Entry {
     }
 };
 
-class FileStorage {
+class FileStorage : public StorageEngine {
 private:
     string filename;
     string delete_filename;
+    // Tombstone changes not yet in the sorted file, each kept sorted: new
+    // tombstones, and pairs inserted again whose stored tombstone is to go.
+    // A full batch is merged into the file in one pass.
+    vector<Entry> pending_deletes;
+    vector<Entry> pending_cancels;
     int operation_count;
     static const int COMPACT_THRESHOLD = 1000;
+    static const size_t PENDING_TOMBSTONES = 1024;
+    static const size_t CHUNK_ENTRIES = 1024;  // entries per read while merging tombstones
 
 public:
     FileStorage(const string& fname) : filename(fname),
@@ -42,11 +65,9 @@ public:
         dfile.close();
     }
 
-    void insert(const string& key, int value) {
-        Entry new_entry;
-        strncpy(new_entry.key, key.c_str(), 64);
-        new_entry.key[64] = '\0';
-        new_entry.value = value;
+    void insert(string_view key, int value) override {
+        Entry new_entry(key, value);
+        cancel_tombstone(new_entry);
 
         // Use append-only approach for better performance
         ofstream file(filename, ios::binary | ios::app);
@@ -60,17 +81,19 @@ public:
         }
     }
 
-    void remove(const string& key, int value) {
-        // Mark entry as deleted by writing to a separate file
-        ofstream delete_file(delete_filename, ios::binary | ios::app);
-
-        Entry delete_entry;
-        strncpy(delete_entry.key, key.c_str(), 64);
-        delete_entry.key[64] = '\0';
-        delete_entry.value = value;
-
-        delete_file.write(reinterpret_cast<char*>(&delete_entry), sizeof(Entry));
-        delete_file.close();
+    void remove(string_view key, int value) override {
+        Entry delete_entry(key, value);
+
+        // A tombstone about to be cancelled stays instead; otherwise one is
+        // added to the batch unless the file already has it
+        if (!erase_sorted(pending_cancels, delete_entry)) {
+            auto it = lower_bound(pending_deletes.begin(), pending_deletes.end(), delete_entry);
+            if ((it == pending_deletes.end() || !(*it == delete_entry)) &&
+                !in_delete_file(delete_entry)) {
+                pending_deletes.insert(it, delete_entry);
+                merge_if_full();
+            }
+        }
 
         operation_count++;
         if (operation_count >= COMPACT_THRESHOLD) {
@@ -79,26 +102,18 @@ public:
         }
     }
 
-    vector<int> find(const string& key) {
+    vector<int> find(string_view key) override {
         // Read all entries from main file
         vector<Entry> entries = read_all_entries(filename);
 
-        // Read deleted entries
-        vector<Entry> deleted_entries = read_all_entries(delete_filename);
+        // Values of key with a tombstone
+        vector<int> deleted_values = find_deleted(key);
 
         // Use set to avoid duplicates and maintain order
         set<int> value_set;
         for (const auto& entry : entries) {
-            if (strcmp(entry.key, key.c_str()) == 0) {
-                // Check if this entry is deleted
-                bool is_deleted = false;
-                for (const auto& deleted : deleted_entries) {
-                    if (entry == deleted) {
-                        is_deleted = true;
-                        break;
-                    }
-                }
-                if (!is_deleted) {
+            if (string_view(entry.key) == key) {
+                if (!binary_search(deleted_values.begin(), deleted_values.end(), entry.value)) {
                     value_set.insert(entry.value);
                 }
             }
@@ -107,7 +122,141 @@ public:
         return vector<int>(value_set.begin(), value_set.end());
     }
 
+    void flush() override {
+        // Data goes straight to the main file; only tombstones wait
+        merge_tombstones();
+    }
+
 private:
+    static size_t entry_count(fstream& file) {
+        file.seekg(0, ios::end);
+        return static_cast<size_t>(file.tellg()) / sizeof(Entry);
+    }
+
+    static bool read_entry(fstream& file, size_t index, Entry& entry) {
+        file.seekg(index * sizeof(Entry));
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&entry), sizeof(Entry)));
+    }
+
+    // Index of the first of count sorted entries in file that is >= target
+    static size_t lower_bound_entry(fstream& file, size_t count, const Entry& target) {
+        size_t lo = 0, hi = count;
+        Entry probe;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            read_entry(file, mid, probe);
+            if (probe < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Remove entry from a sorted batch; false if it was not there
+    static bool erase_sorted(vector<Entry>& batch, const Entry& entry) {
+        auto it = lower_bound(batch.begin(), batch.end(), entry);
+        if (it == batch.end() || !(*it == entry)) {
+            return false;
+        }
+        batch.erase(it);
+        return true;
+    }
+
+    bool in_delete_file(const Entry& entry) {
+        fstream delete_file(delete_filename, ios::binary | ios::in);
+        size_t count = entry_count(delete_file);
+        size_t pos = lower_bound_entry(delete_file, count, entry);
+        Entry at;
+        return pos < count && read_entry(delete_file, pos, at) && at == entry;
+    }
+
+    // Drop the tombstone of a pair inserted again, which would hide the new
+    // copy too: a batched one goes at once, one in the file at the next merge
+    void cancel_tombstone(const Entry& entry) {
+        if (erase_sorted(pending_deletes, entry) || !in_delete_file(entry)) {
+            return;
+        }
+        auto it = lower_bound(pending_cancels.begin(), pending_cancels.end(), entry);
+        if (it == pending_cancels.end() || !(*it == entry)) {
+            pending_cancels.insert(it, entry);
+            merge_if_full();
+        }
+    }
+
+    void merge_if_full() {
+        if (pending_deletes.size() >= PENDING_TOMBSTONES ||
+            pending_cancels.size() >= PENDING_TOMBSTONES) {
+            merge_tombstones();
+        }
+    }
+
+    // Rewrite the tombstone file with the batches applied, streaming it a
+    // chunk at a time, and swap it in
+    void merge_tombstones() {
+        if (pending_deletes.empty() && pending_cancels.empty()) {
+            return;
+        }
+        string tmp_filename = delete_filename + ".tmp";
+        {
+            ifstream in(delete_filename, ios::binary);
+            ofstream out(tmp_filename, ios::binary | ios::trunc);
+            vector<Entry> chunk(CHUNK_ENTRIES);
+            auto pending = pending_deletes.begin();
+            auto cancel = pending_cancels.begin();
+            size_t got;
+            do {
+                in.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(Entry));
+                got = static_cast<size_t>(in.gcount()) / sizeof(Entry);
+                for (size_t i = 0; i < got; i++) {
+                    const Entry& entry = chunk[i];
+                    for (; pending != pending_deletes.end() && *pending < entry; ++pending) {
+                        out.write(reinterpret_cast<const char*>(&*pending), sizeof(Entry));
+                    }
+                    while (cancel != pending_cancels.end() && *cancel < entry) {
+                        ++cancel;
+                    }
+                    if (cancel != pending_cancels.end() && *cancel == entry) {
+                        continue;
+                    }
+                    out.write(reinterpret_cast<const char*>(&entry), sizeof(Entry));
+                }
+            } while (got == chunk.size());
+            for (; pending != pending_deletes.end(); ++pending) {
+                out.write(reinterpret_cast<const char*>(&*pending), sizeof(Entry));
+            }
+        }
+        RandomAccessFile(tmp_filename).sync();
+        replace_file(tmp_filename, delete_filename);
+        pending_deletes.clear();
+        pending_cancels.clear();
+    }
+
+    // Deleted values of key: binary search the sorted tombstone file, minus
+    // the cancelled ones, plus the batched ones
+    vector<int> find_deleted(string_view key) {
+        vector<int> values;
+        fstream delete_file(delete_filename, ios::binary | ios::in);
+
+        Entry low(key, -1);
+
+        size_t count = entry_count(delete_file);
+        Entry entry;
+        for (size_t i = lower_bound_entry(delete_file, count, low);
+             i < count && read_entry(delete_file, i, entry) && strcmp(entry.key, low.key) == 0; i++) {
+            if (!binary_search(pending_cancels.begin(), pending_cancels.end(), entry)) {
+                values.push_back(entry.value);
+            }
+        }
+        for (auto it = lower_bound(pending_deletes.begin(), pending_deletes.end(), low);
+             it != pending_deletes.end() && strcmp(it->key, low.key) == 0; ++it) {
+            values.push_back(it->value);
+        }
+        sort(values.begin(), values.end());
+        return values;
+    }
+
     vector<Entry> read_all_entries(const string& fname) {
         vector<Entry> entries;
         ifstream file(fname, ios::binary);
@@ -126,6 +275,8 @@ private:
     }
 
     void compact_files() {
+        merge_tombstones();
+
         // Read all entries
         vector<Entry> all_entries = read_all_entries(filename);
         vector<Entry> deleted_entries = read_all_entries(delete_filename);
@@ -148,59 +299,24 @@ private:
         auto last = unique(live_entries.begin(), live_entries.end());
         live_entries.erase(last, live_entries.end());
 
-        // Write back compacted file
-        ofstream file(filename, ios::binary | ios::trunc);
+        // Write the compacted file next to the old one and swap it in, so a
+        // crash leaves one of them whole
+        string tmp_filename = filename + ".tmp";
+        ofstream file(tmp_filename, ios::binary | ios::trunc);
         for (const auto& entry : live_entries) {
             file.write(reinterpret_cast<const char*>(&entry), sizeof(Entry));
         }
         file.close();
+        RandomAccessFile(tmp_filename).sync();
+        replace_file(tmp_filename, filename);
 
-        // Clear deletion file
+        // Clear deletion file. A crash just before this leaves tombstones
+        // that were already applied; they act as fresh deletes of their pairs.
         ofstream dfile(delete_filename, ios::binary | ios::trunc);
         dfile.close();
     }
 };
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data.db");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
-        }
-    }
-
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db");
+}
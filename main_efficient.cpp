@@ -1,132 +1,167 @@
-#include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <unordered_map>
+#include <list>
 #include <set>
 #include <cstring>
 
-using namespace std;
+#include "arena.hpp"
+#include "command_loop.hpp"
+#include "slotted_heap.hpp"
+#include "storage_engine.hpp"
 
-// Structure to store key-value pair
-struct Entry {
-    char key[65];  // 64 bytes + null terminator
-    int value;
-};
+using namespace std;
 
-class FileStorage {
+class FileStorage : public StorageEngine {
 private:
-    string filename;
-    unordered_map<string, set<int>> cache;  // In-memory cache for fast access
-    bool cache_dirty;
+    using ValueSet = set<int, less<int>, ArenaAllocator<int>>;
+    using LruList = list<const ArenaString*, ArenaAllocator<const ArenaString*>>;
 
-public:
-    FileStorage(const string& fname) : filename(fname), cache_dirty(false) {
-        load_cache();
-    }
+    struct Cached {
+        ValueSet values;
+        bool dirty;
+        LruList::iterator lru;
+    };
+
+    // Sink that adds a key's stored values, ascending, to its cached ones
+    struct Loader : ValueSink {
+        ValueSet& values;
 
-    ~FileStorage() {
-        if (cache_dirty) {
-            save_cache();
+        explicit Loader(ValueSet& v) : values(v) {}
+
+        void put(const int* v, size_t n) override {
+            for (size_t i = 0; i < n; i++) {
+                values.insert(values.end(), v[i]);
+            }
         }
+    };
+
+    // Arena bytes of a cached key: its map node and string, its LRU node
+    // and one size-class block per set node
+    static const size_t KEY_BYTES = 192;
+    static const size_t VALUE_BYTES = 64;
+
+    SlottedHeap heap;
+    // In-memory cache of the keys used lately, in the arena. Once its
+    // values pass a quarter of the arena cap, the least recently used keys
+    // are dropped, the changed ones written back to the heap on their own.
+    // A key that would take over an eighth of that is never cached: its
+    // values are changed in the heap one at a time.
+    unordered_map<ArenaString, Cached, ArenaStringHash, equal_to<ArenaString>,
+                  ArenaAllocator<pair<const ArenaString, Cached>>> cache;
+    LruList lru;  // cached keys, most recent first
+    size_t cache_bytes;
+    size_t cache_budget;
+
+public:
+    // Only the heap's meta page and directory are read here; keys are
+    // loaded when used
+    FileStorage(const string& fname)
+        : heap(fname), cache_bytes(0), cache_budget(Arena::global().capacity() / 4) {}
+
+    ~FileStorage() override {
+        flush();
     }
 
-    void insert(const string& key, int value) {
-        cache[key].insert(value);
-        cache_dirty = true;
+    void insert(string_view key, int value) override {
+        Cached* cached = values_of(key);
+        if (cached == nullptr) {
+            heap.insert(key, value);
+            return;
+        }
+        if (cached->values.insert(value).second) {
+            cached->dirty = true;
+            cache_bytes += VALUE_BYTES;
+        }
+        make_room();
     }
 
-    void remove(const string& key, int value) {
-        auto it = cache.find(key);
-        if (it != cache.end()) {
-            it->second.erase(value);
-            if (it->second.empty()) {
-                cache.erase(it);
-            }
-            cache_dirty = true;
+    void remove(string_view key, int value) override {
+        Cached* cached = values_of(key);
+        if (cached == nullptr) {
+            heap.remove(key, value);
+            return;
+        }
+        if (cached->values.erase(value) > 0) {
+            cached->dirty = true;
+            cache_bytes -= VALUE_BYTES;
         }
+        make_room();
     }
 
-    vector<int> find(const string& key) {
-        auto it = cache.find(key);
+    vector<int> find(string_view key) override {
+        auto it = cache.find(ArenaString(key));
         if (it == cache.end()) {
-            return {};
+            return heap.find(key);
         }
-        return vector<int>(it->second.begin(), it->second.end());
+        return vector<int>(it->second.values.begin(), it->second.values.end());
     }
 
-private:
-    void load_cache() {
-        ifstream file(filename, ios::binary);
-        if (!file.is_open()) {
+    void find_into(string_view key, ValueSink& sink) override {
+        auto it = cache.find(ArenaString(key));
+        if (it == cache.end()) {
+            heap.find_into(key, sink);
             return;
         }
+        vector<int> values(it->second.values.begin(), it->second.values.end());
+        sink.put(values.data(), values.size());
+    }
 
-        Entry entry;
-        while (file.read(reinterpret_cast<char*>(&entry), sizeof(Entry))) {
-            cache[entry.key].insert(entry.value);
+    void flush() override {
+        for (auto& pair : cache) {
+            write_back(pair.first, pair.second);
         }
-        file.close();
+        heap.flush();
     }
 
-    void save_cache() {
-        ofstream file(filename, ios::binary | ios::trunc);
+private:
+    // Drop least recently used keys until the cache fits its budget; the
+    // key in use, at the front, always stays
+    void make_room() {
+        while (cache_bytes > cache_budget && lru.size() > 1) {
+            auto it = cache.find(*lru.back());
+            write_back(it->first, it->second);
+            cache_bytes -= KEY_BYTES + it->second.values.size() * VALUE_BYTES;
+            lru.pop_back();
+            cache.erase(it);
+        }
+    }
 
-        for (const auto& pair : cache) {
-            for (int value : pair.second) {
-                Entry entry;
-                strncpy(entry.key, pair.first.c_str(), 64);
-                entry.key[64] = '\0';
-                entry.value = value;
-                file.write(reinterpret_cast<const char*>(&entry), sizeof(Entry));
-            }
+    void write_back(const ArenaString& key, Cached& cached) {
+        if (!cached.dirty) {
+            return;
         }
-        file.close();
-        cache_dirty = false;
+        vector<int> values(cached.values.begin(), cached.values.end());
+        heap.assign(key, values.data(), values.size());
+        cached.dirty = false;
     }
-};
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data.db");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
+    // Cached values of key to change, read from the heap the first time,
+    // or nullptr if the heap counts too many to cache; the key becomes
+    // the most recently used
+    Cached* values_of(string_view key) {
+        ArenaString k(key);
+        auto it = cache.find(k);
+        if (it != cache.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return &it->second;
+        }
+        size_t stored = heap.count(key);
+        if (KEY_BYTES + stored * VALUE_BYTES > cache_budget / 8) {
+            return nullptr;
         }
+        it = cache.emplace(move(k), Cached{ValueSet(), false, {}}).first;
+        Loader loader(it->second.values);
+        heap.find_into(key, loader);
+        lru.push_front(&it->first);
+        it->second.lru = lru.begin();
+        cache_bytes += KEY_BYTES + stored * VALUE_BYTES;
+        return &it->second;
     }
+};
 
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db");
+}
@@ -1,10 +1,13 @@
-#include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <cstring>
 
+#include "command_loop.hpp"
+#include "storage_engine.hpp"
+
 using namespace std;
 
 // Structure to store key-value pair
@@ -12,6 +15,18 @@ struct Entry {
     char key[65];  // 64 bytes + null terminator
     int value;
 
+    Entry() = default;
+
+    // Zeroed first: padding and the bytes after the key's NUL are written
+    // to the files too
+    Entry(string_view k, int v) {
+        memset(this, 0, sizeof(Entry));
+        value = v;
+        size_t len = min<size_t>(k.size(), 64);
+        memcpy(key, k.data(), len);
+        key[len] = '\0';
+    }
+
     bool operator<(const Entry& other) const {
         int key_cmp = strcmp(key, other.key);
         if (key_cmp != 0) return key_cmp < 0;
@@ -23,7 +38,7 @@ struct Entry {
     }
 };
 
-class FileStorage {
+class FileStorage : public StorageEngine {
 private:
     string filename;
 
@@ -34,16 +49,13 @@ public:
         file.close();
     }
 
-    void insert(const string& key, int value) {
+    void insert(string_view key, int value) override {
         // Check if entry already exists
         if (exists(key, value)) {
             return;  // Already exists, no need to insert
         }
 
-        Entry new_entry;
-        strncpy(new_entry.key, key.c_str(), 64);
-        new_entry.key[64] = '\0';
-        new_entry.value = value;
+        Entry new_entry(key, value);
 
         // Read all entries and insert in sorted position
         vector<Entry> entries = read_all_entries();
@@ -55,11 +67,8 @@ public:
         write_all_entries(entries);
     }
 
-    void remove(const string& key, int value) {
-        Entry target;
-        strncpy(target.key, key.c_str(), 64);
-        target.key[64] = '\0';
-        target.value = value;
+    void remove(string_view key, int value) override {
+        Entry target(key, value);
 
         // Read all entries and remove target
         vector<Entry> entries = read_all_entries();
@@ -71,26 +80,27 @@ public:
         }
     }
 
-    vector<int> find(const string& key) {
+    vector<int> find(string_view key) override {
         vector<Entry> entries = read_all_entries();
         vector<int> values;
 
         // Binary search for first occurrence of key
-        Entry search_key;
-        strncpy(search_key.key, key.c_str(), 64);
-        search_key.key[64] = '\0';
-        search_key.value = -1;  // Minimum value
+        Entry search_key(key, -1);
 
         auto start = lower_bound(entries.begin(), entries.end(), search_key);
 
         // Collect all values for this key
-        for (auto it = start; it != entries.end() && strcmp(it->key, key.c_str()) == 0; ++it) {
+        for (auto it = start; it != entries.end() && string_view(it->key) == key; ++it) {
             values.push_back(it->value);
         }
 
         return values;
     }
 
+    void flush() override {
+        // Every operation goes straight to the files
+    }
+
 private:
     vector<Entry> read_all_entries() {
         vector<Entry> entries;
@@ -113,11 +123,8 @@ private:
         file.close();
     }
 
-    bool exists(const string& key, int value) {
-        Entry target;
-        strncpy(target.key, key.c_str(), 64);
-        target.key[64] = '\0';
-        target.value = value;
+    bool exists(string_view key, int value) {
+        Entry target(key, value);
 
         vector<Entry> entries = read_all_entries();
         auto pos = lower_bound(entries.begin(), entries.end(), target);
@@ -125,46 +132,6 @@ private:
     }
 };
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data.db");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
-        }
-    }
-
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db");
+}
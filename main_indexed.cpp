@@ -1,229 +1,460 @@
-#include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
-#include <map>
+
+#include "buffer_pool.hpp"
+#include "command_loop.hpp"
+#include "entry.hpp"
+#include "file_io.hpp"
+#include "posting_list.hpp"
+#include "storage_engine.hpp"
+#include "superblock.hpp"
 
 using namespace std;
 
-class FileStorage {
+// data.dat holds a superblock and then one record per key,
+//     [key_len:1][key][capacity:4][count:4][bytes:4][frames: capacity bytes]
+// with the key's values ascending as a posting list (posting_list.hpp) in
+// the first bytes of the frames, and data.idx is an extendible
+// hash table from keys to the offsets of their records: a directory of
+// 2^depth bucket page numbers indexed by the low bits of the key's hash,
+// each bucket holding the (hash, offset) slots of its keys. An insert or
+// delete touches one bucket page and the key's own record, so its cost
+// depends on how many values the key has, not on how many keys there are:
+// it reads the key's frames, skips to the one frame that can hold the value
+// by their headers, and rewrites the frames from that one on.
+//
+// A full bucket splits in two by one more bit of the hash, doubling the
+// directory when no bit is left. A full record moves to the end of
+// data.dat with twice the capacity; the space it leaves is not reused,
+// which at most doubles the file.
+//
+// The superblock says where the directory is, how deep it is and how many
+// index pages there are, so a run that follows a clean one starts with a
+// single read. It is marked unclean before the first change of a run and
+// clean again once flush() has written everything back; a run that finds
+// it unclean rebuilds data.idx from the records, the last one of each key
+// being the current one.
+class FileStorage : public StorageEngine {
 private:
-    string data_file;
-    string index_file;
+    static const int PAGE_SIZE = 4096;
+    static const size_t POOL_BYTES = 64 * PAGE_SIZE;
+    static const uint32_t DATA_MAGIC = 0x49445833;  // "IDX3"
+    static const uint32_t MIN_CAPACITY = 32;  // bytes of frames
+    static const size_t MAX_KEY = 64;
+    static const size_t MAX_HEAD = 1 + MAX_KEY + 3 * sizeof(uint32_t);
+
+    struct Slot {
+        uint64_t hash;
+        uint64_t offset;
+    };
+
+    struct BucketHeader {
+        int depth;  // bits of the hash all keys in the bucket share
+        int count;
+    };
+
+    static const int BUCKET_SLOTS = (PAGE_SIZE - sizeof(BucketHeader)) / sizeof(Slot);
+
+    struct Bucket {
+        BucketHeader header;
+        Slot slots[BUCKET_SLOTS];
+    };
+
+    // Where a key's record is and what it holds
+    struct Record {
+        uint64_t offset;
+        uint32_t capacity;
+        uint32_t count;
+        uint32_t bytes;   // of the frames in use
+        uint64_t frames;  // offset of the frames
+    };
+
+    using PageRef = BufferPool::PageRef;
+
+    RandomAccessFile data;
+    BufferPool pool;
+    // directory is the first page of the directory, directory_bytes its
+    // size and space_end the number of index pages
+    Superblock super;
+    int depth;              // bits of the hash the directory uses
+    vector<int> directory;  // bucket page of every hash suffix
+    bool directory_dirty;
+    long long data_end;
 
 public:
-    FileStorage(const string& base_name) :
-        data_file(base_name + ".dat"),
-        index_file(base_name + ".idx") {
-        // Create files if they don't exist
-        ofstream dfile(data_file, ios::binary | ios::app);
-        dfile.close();
-        ofstream ifile(index_file, ios::binary | ios::app);
-        ifile.close();
-    }
-
-    void insert(const string& key, int value) {
-        // Check if entry already exists
-        if (exists(key, value)) {
-            return;
+    FileStorage(const string& base_name)
+        : data(base_name + ".dat"), pool(base_name + ".idx", PAGE_SIZE, POOL_BYTES), super(DATA_MAGIC),
+          depth(0), directory_dirty(false), data_end(Superblock::BYTES) {
+        if (!super.read(data, DATA_MAGIC)) {
+            // New files, clean once flush() writes the index out
+            reset_index();
+            super.clean = 0;
+            super.write(data);
+        } else if (!super.clean || pool.page_count() < static_cast<long long>(super.space_end)) {
+            rebuild_index();
+        } else {
+            data_end = data.size();
+            depth = __builtin_ctzll(super.directory_bytes / sizeof(int));
+            load_directory();
         }
+    }
 
-        // Append to data file
-        ofstream data(data_file, ios::binary | ios::app);
-
-        // Write key length and key
-        uint8_t key_len = key.length();
-        data.write(reinterpret_cast<char*>(&key_len), sizeof(key_len));
-        data.write(key.c_str(), key_len);
-
-        // Write value
-        data.write(reinterpret_cast<char*>(&value), sizeof(value));
-        data.close();
-
-        // Update index
-        update_index();
+    ~FileStorage() override {
+        flush();
     }
 
-    void remove(const string& key, int value) {
-        // Mark as deleted in index
-        map<string, vector<int>> index = read_index();
+    void insert(string_view key, int value) override {
+        key = key.substr(0, MAX_KEY);
+        uint64_t hash = hash_of(key);
+        Record record;
+        if (!locate(key, hash, record)) {
+            // New key: a record with room to grow, then its slot
+            begin_change();
+            super.key_count++;
+            super.value_count++;
+            record = {static_cast<uint64_t>(data_end), MIN_CAPACITY, 0, 0, 0};
+            vector<char> frames;
+            encode_frame(&value, 1, frames);
+            write_record(key, record, frames, 1);
+            add_slot(hash, record.offset);
+            return;
+        }
 
-        auto it = index.find(key);
-        if (it != index.end()) {
-            auto& values = it->second;
-            auto val_it = find(values.begin(), values.end(), value);
-            if (val_it != values.end()) {
-                values.erase(val_it);
-                if (values.empty()) {
-                    index.erase(it);
-                }
-                write_index(index);
-            }
+        vector<char> frames = read_frames(record);
+        size_t at = seek_frame(frames.data(), frames.size(), value);
+        vector<int> values;
+        if (at < frames.size()) {
+            decode_frame(frames.data() + at, values);
+        }
+        auto it = lower_bound(values.begin(), values.end(), value);
+        if (it != values.end() && *it == value) {
+            return;
+        }
+        values.insert(it, value);
+        begin_change();
+        super.value_count++;
+        replace_frame(frames, at, values);
+
+        if (frames.size() > record.capacity) {
+            // Move the record to the end of the file with twice the room
+            uint32_t capacity = max<size_t>(record.capacity * 2, frames.size());
+            Record moved = {static_cast<uint64_t>(data_end), capacity, 0, 0, 0};
+            write_record(key, moved, frames, record.count + 1);
+            set_slot(hash, record.offset, moved.offset);
+            return;
         }
+        write_frames(record, frames, at, record.count + 1);
     }
 
-    vector<int> find(const string& key) {
-        map<string, vector<int>> index = read_index();
-        auto it = index.find(key);
-        if (it == index.end()) {
-            return {};
+    void remove(string_view key, int value) override {
+        key = key.substr(0, MAX_KEY);
+        Record record;
+        if (!locate(key, hash_of(key), record)) {
+            return;
         }
 
-        vector<int> result = it->second;
-        sort(result.begin(), result.end());
-        return result;
+        vector<char> frames = read_frames(record);
+        size_t at = seek_frame(frames.data(), frames.size(), value);
+        if (at == frames.size()) {
+            return;
+        }
+        FrameHeader frame = frame_header(frames.data() + at);
+        if (value < frame.first || value > frame.last) {
+            return;  // Not in the only frame that could hold it
+        }
+        vector<int> values;
+        decode_frame(frames.data() + at, values);
+        auto it = lower_bound(values.begin(), values.end(), value);
+        if (it == values.end() || *it != value) {
+            return;
+        }
+        values.erase(it);
+        begin_change();
+        super.value_count--;
+        replace_frame(frames, at, values);
+        write_frames(record, frames, at, record.count - 1);
     }
 
-private:
-    bool exists(const string& key, int value) {
-        map<string, vector<int>> index = read_index();
-        auto it = index.find(key);
-        if (it == index.end()) {
-            return false;
+    vector<int> find(string_view key) override {
+        key = key.substr(0, MAX_KEY);
+        Record record;
+        if (!locate(key, hash_of(key), record)) {
+            return {};
         }
-
-        const auto& values = it->second;
-        return find(values.begin(), values.end(), value) != values.end();
+        vector<char> frames = read_frames(record);
+        vector<int> values;
+        values.reserve(record.count);
+        decode_frames(frames.data(), frames.size(), values);
+        return values;
     }
 
-    void update_index() {
-        // Rebuild index from data file
-        map<string, vector<int>> index;
-
-        ifstream data(data_file, ios::binary);
-        if (!data.is_open()) {
+    void flush() override {
+        if (super.clean) {
             return;
         }
+        save_directory();
+        pool.flush();
+        super.clean = 1;
+        super.write(data);
+    }
 
-        while (data.peek() != EOF) {
-            // Read key length
-            uint8_t key_len;
-            data.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
+private:
+    static uint64_t hash_of(string_view key) {
+        return Entry::hash_key(key.data(), key.size());
+    }
 
-            // Read key
-            char key_buf[65];
-            data.read(key_buf, key_len);
-            key_buf[key_len] = '\0';
-            string key(key_buf);
+    int allocate_pages(int n) {
+        int first = super.space_end;
+        super.space_end += n;
+        return first;
+    }
 
-            // Read value
-            int value;
-            data.read(reinterpret_cast<char*>(&value), sizeof(value));
+    int bucket_of(uint64_t hash) const {
+        return directory[hash & ((1ULL << depth) - 1)];
+    }
 
-            // Add to index
-            index[key].push_back(value);
+    // Mark the files unclean on disk before the first change of a run
+    void begin_change() {
+        if (super.clean) {
+            super.clean = 0;
+            super.write(data);
         }
+    }
 
-        data.close();
-        write_index(index);
+    // Start over with a one-entry directory and one empty bucket
+    void reset_index() {
+        depth = 0;
+        super.space_end = 0;
+        super.directory = allocate_pages(1);
+        int bucket = allocate_pages(1);
+        pool.create(bucket).as<Bucket>()->header = {0, 0};
+        directory.assign(1, bucket);
+        directory_dirty = true;
     }
 
-    map<string, vector<int>> read_index() {
-        map<string, vector<int>> index;
+    // Index every record of data.dat after a run that did not finish,
+    // stopping at a record the run did not finish writing
+    void rebuild_index() {
+        super.clean = 0;
+        super.key_count = 0;
+        super.value_count = 0;
+        reset_index();
+
+        long long size = data.size();
+        long long offset = Superblock::BYTES;
+        char head[MAX_HEAD];
+        while (offset < size) {
+            size_t got = data.read_at(offset, head, sizeof(head));
+            uint8_t key_len = head[0];
+            uint32_t capacity, count, bytes;
+            if (key_len > MAX_KEY || got < 1 + key_len + 3 * sizeof(uint32_t)) {
+                break;
+            }
+            memcpy(&capacity, head + 1 + key_len, sizeof(uint32_t));
+            memcpy(&count, head + 1 + key_len + sizeof(uint32_t), sizeof(uint32_t));
+            memcpy(&bytes, head + 1 + key_len + 2 * sizeof(uint32_t), sizeof(uint32_t));
+            long long end = offset + 1 + key_len + 3 * sizeof(uint32_t) + capacity;
+            if (bytes > capacity || end > size) {
+                break;
+            }
 
-        ifstream idx(index_file, ios::binary);
-        if (!idx.is_open()) {
-            return index;
+            string_view key(head + 1, key_len);
+            uint64_t hash = hash_of(key);
+            Record old;
+            if (locate(key, hash, old)) {
+                set_slot(hash, old.offset, offset);
+                super.value_count -= old.count;
+            } else {
+                add_slot(hash, offset);
+                super.key_count++;
+            }
+            super.value_count += count;
+            offset = end;
         }
+        data_end = offset;
+    }
 
-        while (idx.peek() != EOF) {
-            // Read key length
-            uint8_t key_len;
-            idx.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
+    static int directory_pages(int depth) {
+        size_t bytes = (size_t(1) << depth) * sizeof(int);
+        return (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
 
-            // Read key
-            char key_buf[65];
-            idx.read(key_buf, key_len);
-            key_buf[key_len] = '\0';
-            string key(key_buf);
+    void load_directory() {
+        directory.resize(size_t(1) << depth);
+        size_t bytes = directory.size() * sizeof(int);
+        for (int i = 0; i < directory_pages(depth); i++) {
+            size_t n = min<size_t>(PAGE_SIZE, bytes - i * PAGE_SIZE);
+            memcpy(reinterpret_cast<char*>(directory.data()) + i * PAGE_SIZE,
+                   pool.fetch(super.directory + i).as<char>(), n);
+        }
+    }
 
-            // Read value count
-            uint32_t value_count;
-            idx.read(reinterpret_cast<char*>(&value_count), sizeof(value_count));
+    void save_directory() {
+        if (!directory_dirty) {
+            return;
+        }
+        size_t bytes = directory.size() * sizeof(int);
+        for (int i = 0; i < directory_pages(depth); i++) {
+            size_t n = min<size_t>(PAGE_SIZE, bytes - i * PAGE_SIZE);
+            memcpy(pool.create(super.directory + i).as<char>(),
+                   reinterpret_cast<const char*>(directory.data()) + i * PAGE_SIZE, n);
+        }
+        super.directory_bytes = bytes;
+        directory_dirty = false;
+    }
 
-            // Read values
-            vector<int> values(value_count);
-            for (uint32_t i = 0; i < value_count; i++) {
-                int value;
-                idx.read(reinterpret_cast<char*>(&value), sizeof(value));
-                values[i] = value;
+    // Find key's record through its bucket
+    bool locate(string_view key, uint64_t hash, Record& record) {
+        PageRef page = pool.fetch(bucket_of(hash));
+        const Bucket* bucket = page.as<Bucket>();
+        for (int i = 0; i < bucket->header.count; i++) {
+            if (bucket->slots[i].hash == hash && read_record(bucket->slots[i].offset, key, record)) {
+                return true;
             }
-
-            index[key] = values;
         }
+        return false;
+    }
 
-        idx.close();
-        return index;
+    // Read the record at offset if it is key's
+    bool read_record(uint64_t offset, string_view key, Record& record) {
+        char head[MAX_HEAD];
+        data.read_at(offset, head, sizeof(head));
+        uint8_t key_len = head[0];
+        if (string_view(head + 1, key_len) != key) {
+            return false;
+        }
+        record.offset = offset;
+        memcpy(&record.capacity, head + 1 + key_len, sizeof(uint32_t));
+        memcpy(&record.count, head + 1 + key_len + sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(&record.bytes, head + 1 + key_len + 2 * sizeof(uint32_t), sizeof(uint32_t));
+        record.frames = offset + 1 + key_len + 3 * sizeof(uint32_t);
+        return true;
     }
 
-    void write_index(const map<string, vector<int>>& index) {
-        ofstream idx(index_file, ios::binary | ios::trunc);
+    vector<char> read_frames(const Record& record) {
+        vector<char> frames(record.bytes);
+        data.read_at(record.frames, frames.data(), frames.size());
+        return frames;
+    }
 
-        for (const auto& pair : index) {
-            const string& key = pair.first;
-            const vector<int>& values = pair.second;
+    // Put values, ascending, in place of the frame at offset at of frames:
+    // as one frame, two halves if they outgrew one, or none at all
+    static void replace_frame(vector<char>& frames, size_t at, const vector<int>& values) {
+        vector<char> encoded;
+        size_t n = values.size();
+        if (n > FrameHeader::MAX_VALUES) {
+            encode_frame(values.data(), n / 2, encoded);
+            encode_frame(values.data() + n / 2, n - n / 2, encoded);
+        } else if (n > 0) {
+            encode_frame(values.data(), n, encoded);
+        }
+        size_t old_size = at < frames.size() ? frame_size(frames.data() + at) : 0;
+        frames.erase(frames.begin() + at, frames.begin() + at + old_size);
+        frames.insert(frames.begin() + at, encoded.begin(), encoded.end());
+    }
 
-            // Write key length and key
-            uint8_t key_len = key.length();
-            idx.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-            idx.write(key.c_str(), key_len);
+    // Write the whole record at record.offset, which is the end of the file
+    void write_record(string_view key, Record& record, const vector<char>& frames, uint32_t count) {
+        record.count = count;
+        record.bytes = frames.size();
+        vector<char> out(1 + key.size() + 3 * sizeof(uint32_t) + record.capacity, 0);
+        out[0] = static_cast<char>(key.size());
+        memcpy(out.data() + 1, key.data(), key.size());
+        char* p = out.data() + 1 + key.size();
+        memcpy(p, &record.capacity, sizeof(uint32_t));
+        memcpy(p + sizeof(uint32_t), &record.count, sizeof(uint32_t));
+        memcpy(p + 2 * sizeof(uint32_t), &record.bytes, sizeof(uint32_t));
+        memcpy(p + 3 * sizeof(uint32_t), frames.data(), frames.size());
+        data.write_at(record.offset, out.data(), out.size());
+        record.frames = record.offset + 1 + key.size() + 3 * sizeof(uint32_t);
+        data_end = record.offset + out.size();
+    }
 
-            // Write value count
-            uint32_t value_count = values.size();
-            idx.write(reinterpret_cast<const char*>(&value_count), sizeof(value_count));
+    // Store frames in place, rewriting them from offset from on, with the
+    // count of values and bytes they hold
+    void write_frames(Record& record, const vector<char>& frames, size_t from, uint32_t count) {
+        record.count = count;
+        record.bytes = frames.size();
+        if (from < frames.size()) {
+            data.write_at(record.frames + from, frames.data() + from, frames.size() - from);
+        }
+        uint32_t sizes[2] = {record.count, record.bytes};
+        data.write_at(record.frames - sizeof(sizes), sizes, sizeof(sizes));
+    }
 
-            // Write values
-            for (int value : values) {
-                idx.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    // Point the slot of hash at old_offset to new_offset
+    void set_slot(uint64_t hash, uint64_t old_offset, uint64_t new_offset) {
+        PageRef page = pool.fetch(bucket_of(hash));
+        Bucket* bucket = page.as<Bucket>();
+        for (int i = 0; i < bucket->header.count; i++) {
+            if (bucket->slots[i].offset == old_offset) {
+                bucket->slots[i].offset = new_offset;
+                page.mark_dirty();
+                return;
             }
         }
+    }
 
-        idx.close();
+    void add_slot(uint64_t hash, uint64_t offset) {
+        for (;;) {
+            int id = bucket_of(hash);
+            PageRef page = pool.fetch(id);
+            Bucket* bucket = page.as<Bucket>();
+            if (bucket->header.count < BUCKET_SLOTS) {
+                bucket->slots[bucket->header.count++] = {hash, offset};
+                page.mark_dirty();
+                return;
+            }
+            split(id, page);
+        }
     }
-};
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
+    // Move the slots of a full bucket whose next hash bit is set to a new
+    // bucket, doubling the directory first if the bucket uses every bit
+    void split(int id, PageRef& page) {
+        Bucket* bucket = page.as<Bucket>();
+        int bucket_depth = bucket->header.depth;
+        if (bucket_depth == depth) {
+            size_t size = directory.size();
+            directory.resize(size * 2);
+            copy(directory.begin(), directory.begin() + size, directory.begin() + size);
+            depth++;
+            // The old directory pages are left unused
+            super.directory = allocate_pages(directory_pages(depth));
+        }
+
+        int sibling_id = allocate_pages(1);
+        PageRef sibling_page = pool.create(sibling_id);
+        Bucket* sibling = sibling_page.as<Bucket>();
+        sibling->header = {bucket_depth + 1, 0};
+        bucket->header.depth = bucket_depth + 1;
+
+        uint64_t bit = 1ULL << bucket_depth;
+        int kept = 0;
+        for (int i = 0; i < bucket->header.count; i++) {
+            const Slot& slot = bucket->slots[i];
+            if (slot.hash & bit) {
+                sibling->slots[sibling->header.count++] = slot;
             } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
+                bucket->slots[kept++] = slot;
             }
         }
+        bucket->header.count = kept;
+        page.mark_dirty();
+
+        for (size_t i = 0; i < directory.size(); i++) {
+            if (directory[i] == id && (i & bit)) {
+                directory[i] = sibling_id;
+            }
+        }
+        directory_dirty = true;
     }
+};
 
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data");
+}
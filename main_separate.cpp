@@ -1,141 +1,43 @@
-#include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <algorithm>
-#include <cstring>
-#include <set>
-#include <filesystem>
+
+#include "command_loop.hpp"
+#include "slotted_heap.hpp"
+#include "storage_engine.hpp"
 
 using namespace std;
 
-class FileStorage {
+// Every key's values, read and written one key at a time, in the slotted
+// pages of a single file rather than a file per key
+class FileStorage : public StorageEngine {
 private:
-    string data_dir;
+    SlottedHeap heap;
 
 public:
-    FileStorage(const string& dir) : data_dir(dir) {
-        // Create data directory if it doesn't exist
-        filesystem::create_directories(data_dir);
-    }
-
-    void insert(const string& key, int value) {
-        string filename = data_dir + "/" + key + ".dat";
+    FileStorage(const string& fname) : heap(fname) {}
 
-        // Read existing values
-        set<int> values = read_values(filename);
-
-        // Insert new value
-        values.insert(value);
-
-        // Write back to file
-        write_values(filename, values);
+    void insert(string_view key, int value) override {
+        heap.insert(key, value);
     }
 
-    void remove(const string& key, int value) {
-        string filename = data_dir + "/" + key + ".dat";
-
-        // Check if file exists
-        if (!filesystem::exists(filename)) {
-            return;
-        }
-
-        // Read existing values
-        set<int> values = read_values(filename);
-
-        // Remove value if exists
-        values.erase(value);
-
-        // Write back to file or delete if empty
-        if (values.empty()) {
-            filesystem::remove(filename);
-        } else {
-            write_values(filename, values);
-        }
+    void remove(string_view key, int value) override {
+        heap.remove(key, value);
     }
 
-    vector<int> find(const string& key) {
-        string filename = data_dir + "/" + key + ".dat";
-
-        // Check if file exists
-        if (!filesystem::exists(filename)) {
-            return {};
-        }
-
-        // Read values
-        set<int> values = read_values(filename);
-        return vector<int>(values.begin(), values.end());
+    vector<int> find(string_view key) override {
+        return heap.find(key);
     }
 
-private:
-    set<int> read_values(const string& filename) {
-        set<int> values;
-
-        ifstream file(filename, ios::binary);
-        if (!file.is_open()) {
-            return values;
-        }
-
-        int value;
-        while (file.read(reinterpret_cast<char*>(&value), sizeof(int))) {
-            values.insert(value);
-        }
-
-        file.close();
-        return values;
+    void find_into(string_view key, ValueSink& sink) override {
+        heap.find_into(key, sink);
     }
 
-    void write_values(const string& filename, const set<int>& values) {
-        ofstream file(filename, ios::binary | ios::trunc);
-
-        for (int value : values) {
-            file.write(reinterpret_cast<const char*>(&value), sizeof(int));
-        }
-
-        file.close();
+    void flush() override {
+        heap.flush();
     }
 };
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
-        }
-    }
-
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db");
+}
@@ -1,163 +1,165 @@
-#include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <cstring>
+#include <list>
 #include <map>
 
+#include "arena.hpp"
+#include "command_loop.hpp"
+#include "slotted_heap.hpp"
+#include "storage_engine.hpp"
+
 using namespace std;
 
-class FileStorage {
+class FileStorage : public StorageEngine {
 private:
-    string filename;
-    map<string, vector<int>> data;
-    bool modified;
+    using Values = ArenaVector<int>;
+    using LruList = list<const ArenaString*, ArenaAllocator<const ArenaString*>>;
+
+    struct Cached {
+        Values values;  // ascending
+        bool dirty;
+        LruList::iterator lru;
+    };
+
+    // Sink that appends a key's stored values to its cached ones
+    struct Loader : ValueSink {
+        Values& values;
+
+        explicit Loader(Values& v) : values(v) {}
+
+        void put(const int* v, size_t n) override {
+            values.insert(values.end(), v, v + n);
+        }
+    };
+
+    // Arena bytes of a key besides its values: map node, string, LRU node
+    static const size_t KEY_BYTES = 192;
+
+    SlottedHeap heap;
+    // Keys used lately, in the arena. Once they pass a quarter of the
+    // arena cap, the least recently used are dropped, and the changed ones
+    // among them written back to the heap one key at a time. A key with
+    // more values than an eighth of that holds is changed in the heap
+    // directly instead.
+    map<ArenaString, Cached, less<>, ArenaAllocator<pair<const ArenaString, Cached>>> data;
+    LruList lru;  // keys in data, most recent first
+    size_t data_bytes;
+    size_t data_budget;
 
 public:
-    FileStorage(const string& fname) : filename(fname), modified(false) {
-        load_data();
+    // Only the heap's meta page and directory are read here; keys are
+    // loaded when used
+    FileStorage(const string& fname)
+        : heap(fname), data_bytes(0), data_budget(Arena::global().capacity() / 4) {}
+
+    ~FileStorage() override {
+        flush();
     }
 
-    ~FileStorage() {
-        if (modified) {
-            save_data();
+    void insert(string_view key, int value) override {
+        Cached* cached = values_of(key);
+        if (cached == nullptr) {
+            heap.insert(key, value);
+            return;
         }
+        auto& values = cached->values;
+        auto val_it = lower_bound(values.begin(), values.end(), value);
+        if (val_it == values.end() || *val_it != value) {
+            data_bytes -= values.capacity() * sizeof(int);
+            values.insert(val_it, value);
+            data_bytes += values.capacity() * sizeof(int);
+            cached->dirty = true;
+        }
+        make_room();
     }
 
-    void insert(const string& key, int value) {
-        auto& values = data[key];
-        if (find(values.begin(), values.end(), value) == values.end()) {
-            values.push_back(value);
-            modified = true;
+    void remove(string_view key, int value) override {
+        Cached* cached = values_of(key);
+        if (cached == nullptr) {
+            heap.remove(key, value);
+            return;
         }
+        auto& values = cached->values;
+        auto val_it = lower_bound(values.begin(), values.end(), value);
+        if (val_it != values.end() && *val_it == value) {
+            values.erase(val_it);
+            cached->dirty = true;
+        }
+        make_room();
     }
 
-    void remove(const string& key, int value) {
+    vector<int> find(string_view key) override {
         auto it = data.find(key);
-        if (it != data.end()) {
-            auto& values = it->second;
-            auto val_it = find(values.begin(), values.end(), value);
-            if (val_it != values.end()) {
-                values.erase(val_it);
-                modified = true;
-                if (values.empty()) {
-                    data.erase(it);
-                }
-            }
+        if (it == data.end()) {
+            return heap.find(key);
         }
+        return vector<int>(it->second.values.begin(), it->second.values.end());
     }
 
-    vector<int> find(const string& key) {
+    void find_into(string_view key, ValueSink& sink) override {
         auto it = data.find(key);
         if (it == data.end()) {
-            return {};
+            heap.find_into(key, sink);
+            return;
         }
-
-        vector<int> result = it->second;
-        sort(result.begin(), result.end());
-        return result;
+        sink.put(it->second.values.data(), it->second.values.size());
     }
 
-private:
-    void load_data() {
-        ifstream file(filename, ios::binary);
-        if (!file.is_open()) {
-            return;
+    void flush() override {
+        for (auto& pair : data) {
+            write_back(pair.first, pair.second);
         }
+        heap.flush();
+    }
 
-        while (file.peek() != EOF) {
-            // Read key length
-            uint8_t key_len;
-            file.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
-
-            // Read key
-            char key_buf[65];
-            file.read(key_buf, key_len);
-            key_buf[key_len] = '\0';
-            string key(key_buf);
-
-            // Read value count
-            uint32_t value_count;
-            file.read(reinterpret_cast<char*>(&value_count), sizeof(value_count));
-
-            // Read values
-            for (uint32_t i = 0; i < value_count; i++) {
-                int value;
-                file.read(reinterpret_cast<char*>(&value), sizeof(value));
-                data[key].push_back(value);
-            }
+private:
+    // Drop least recently used keys until the rest fit the budget; the key
+    // in use, at the front, always stays
+    void make_room() {
+        while (data_bytes > data_budget && lru.size() > 1) {
+            auto it = data.find(*lru.back());
+            write_back(it->first, it->second);
+            data_bytes -= KEY_BYTES + it->second.values.capacity() * sizeof(int);
+            lru.pop_back();
+            data.erase(it);
         }
-
-        file.close();
     }
 
-    void save_data() {
-        ofstream file(filename, ios::binary | ios::trunc);
-
-        for (const auto& pair : data) {
-            const string& key = pair.first;
-            const vector<int>& values = pair.second;
-
-            // Write key length and key
-            uint8_t key_len = key.length();
-            file.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-            file.write(key.c_str(), key_len);
-
-            // Write value count
-            uint32_t value_count = values.size();
-            file.write(reinterpret_cast<const char*>(&value_count), sizeof(value_count));
-
-            // Write values
-            for (int value : values) {
-                file.write(reinterpret_cast<const char*>(&value), sizeof(value));
-            }
+    void write_back(const ArenaString& key, Cached& cached) {
+        if (!cached.dirty) {
+            return;
         }
-
-        file.close();
+        heap.assign(key, cached.values.data(), cached.values.size());
+        cached.dirty = false;
     }
-};
 
-int main() {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    FileStorage storage("data.db");
-
-    int n;
-    cin >> n;
-    cin.ignore();  // Ignore newline after n
-
-    for (int i = 0; i < n; i++) {
-        string command;
-        cin >> command;
-
-        if (command == "insert") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.insert(key, value);
-        } else if (command == "delete") {
-            string key;
-            int value;
-            cin >> key >> value;
-            storage.remove(key, value);
-        } else if (command == "find") {
-            string key;
-            cin >> key;
-            vector<int> values = storage.find(key);
-
-            if (values.empty()) {
-                cout << "null\n";
-            } else {
-                for (size_t j = 0; j < values.size(); j++) {
-                    if (j > 0) cout << " ";
-                    cout << values[j];
-                }
-                cout << "\n";
-            }
+    // Values of key to change, read from the heap the first time, or
+    // nullptr if the heap counts too many to keep; the key becomes the
+    // most recently used
+    Cached* values_of(string_view key) {
+        auto it = data.find(key);
+        if (it != data.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return &it->second;
+        }
+        size_t stored = heap.count(key);
+        if (KEY_BYTES + stored * sizeof(int) > data_budget / 8) {
+            return nullptr;
         }
+        it = data.emplace(ArenaString(key), Cached{Values(), false, {}}).first;
+        it->second.values.reserve(stored);
+        Loader loader(it->second.values);
+        heap.find_into(key, loader);
+        lru.push_front(&it->first);
+        it->second.lru = lru.begin();
+        data_bytes += KEY_BYTES + it->second.values.capacity() * sizeof(int);
+        return &it->second;
     }
+};
 
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char* argv[]) {
+    return open_and_run<FileStorage>(argc, argv, "data.db");
+}
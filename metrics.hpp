@@ -0,0 +1,345 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "storage_engine.hpp"
+
+#ifndef STORAGE_METRICS_DEFAULT
+#define STORAGE_METRICS_DEFAULT nullptr
+#endif
+
+// Per-operation I/O counters and latency histograms, off unless the
+// STORAGE_METRICS environment variable is set (or the build sets
+// STORAGE_METRICS_DEFAULT): "stderr" or "1" prints a table to stderr at
+// exit, any other value is a path the same numbers are written to as JSON.
+//
+// Everything is charged to the operation in progress: OPEN from the first
+// file opened (for engines without RandomAccessFile, from the start of the
+// command loop) until the engine is handed to the loop, INSERT/REMOVE/FIND
+// for the engine calls (work an insert triggers, like a compaction, is the
+// insert's), FLUSH for flushes and shutdown, and LOOP for the time between
+// engine calls, which is input parsing and output. Two views of I/O are
+// kept:
+//   - file: what RandomAccessFile and BufferPool see, so it is exact for
+//     every engine built on them but misses mapped reads;
+//   - kernel: deltas of /proc/self/io around each operation, which also
+//     covers iostream-based backends and includes stdio-level buffering.
+// The arena's cap and peak are reported alongside, and so is the write
+// amplification of engines that count it: bytes written to their files per
+// byte of insert/delete records taken in.
+class Metrics {
+public:
+    enum Op { OPEN, INSERT, REMOVE, FIND, FLUSH, LOOP, OP_COUNT };
+
+    static const long long IO_BLOCK_BYTES = 4096;
+
+private:
+    // Latencies in nanoseconds, in buckets of 4 per power of two
+    class Histogram {
+    private:
+        static const int SUB_BUCKETS = 4;
+        std::vector<long long> buckets;
+        long long total_ns;
+        long long max_ns;
+
+    public:
+        long long count;
+
+        Histogram() : buckets(64 * SUB_BUCKETS), total_ns(0), max_ns(0), count(0) {}
+
+        void add(long long ns) {
+            if (ns < 1) ns = 1;
+            int log = 63 - __builtin_clzll(ns);
+            int sub = log >= 2 ? (ns >> (log - 2)) & (SUB_BUCKETS - 1) : 0;
+            buckets[log * SUB_BUCKETS + sub]++;
+            total_ns += ns;
+            if (ns > max_ns) max_ns = ns;
+            count++;
+        }
+
+        long long mean() const {
+            return count > 0 ? total_ns / count : 0;
+        }
+
+        long long max() const {
+            return max_ns;
+        }
+
+        // Upper bound of the bucket holding quantile q
+        long long percentile(double q) const {
+            long long rank = static_cast<long long>(q * count + 0.5);
+            if (rank < 1) rank = 1;
+            long long seen = 0;
+            for (size_t i = 0; i < buckets.size(); i++) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    int log = i / SUB_BUCKETS;
+                    int sub = i % SUB_BUCKETS;
+                    long long upper = log >= 2 ? (1LL << log) + ((sub + 1LL) << (log - 2)) - 1 : (2LL << log) - 1;
+                    return upper < max_ns ? upper : max_ns;
+                }
+            }
+            return max_ns;
+        }
+    };
+
+    struct Kernel {
+        long long rchar = 0, wchar = 0, syscr = 0, syscw = 0;
+        long long probe_bytes = 0;  // read from /proc/self/io to get these
+    };
+
+public:
+    struct FileIo {
+        long long opens = 0;
+        long long reads = 0;  // pread calls
+        long long writes = 0;  // pwrite calls
+        long long bytes_read = 0;
+        long long bytes_written = 0;
+        long long seeks = 0;     // accesses not starting where the last one on the file ended
+        long long blocks = 0;    // IO_BLOCK_BYTES blocks covered by reads and writes
+        long long pages = 0;     // buffer pool pages fetched, cached or not
+        long long syscalls = 0;  // every file system call, including open/fstat/ftruncate
+    };
+
+private:
+    struct OpStats {
+        Histogram latency;
+        FileIo file;
+        Kernel kernel;
+    };
+
+    std::string destination;
+    OpStats ops[OP_COUNT];
+    long long ingested_bytes;  // -1 if no engine reported any
+    long long engine_written_bytes;
+    Op current;
+    std::chrono::steady_clock::time_point op_start;
+    Kernel kernel_start;
+
+    explicit Metrics(const char* dest)
+        : destination(dest), ingested_bytes(-1), engine_written_bytes(0), current(OPEN), op_start(std::chrono::steady_clock::now()),
+          kernel_start(read_kernel()) {
+        Arena::global();  // Constructed first, so it is still there when this reports
+    }
+
+public:
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    ~Metrics() {
+        switch_to(LOOP);
+        if (destination == "stderr" || destination == "1") {
+            print_table();
+        } else {
+            write_json();
+        }
+    }
+
+    // The process-wide instance, or nullptr when metrics are off
+    static Metrics* active() {
+        static Metrics* instance = create();
+        return instance;
+    }
+
+    // Close the running operation and start timing op
+    void begin(Op op) {
+        switch_to(op);
+    }
+
+    // Close the running operation; what follows is LOOP
+    void end() {
+        switch_to(LOOP);
+    }
+
+    FileIo& file() {
+        return ops[current].file;
+    }
+
+    // A positioned read or write of n bytes at offset that took calls syscalls
+    void file_access(bool write, long long offset, size_t n, long long calls, bool seek) {
+        FileIo& io = file();
+        (write ? io.writes : io.reads) += calls;
+        (write ? io.bytes_written : io.bytes_read) += n;
+        io.syscalls += calls;
+        io.seeks += seek;
+        if (n > 0) {
+            io.blocks += (offset + n - 1) / IO_BLOCK_BYTES - offset / IO_BLOCK_BYTES + 1;
+        }
+    }
+
+    // An engine has taken in ingested bytes of records and written written
+    // bytes for them so far; the last report is the one printed
+    void write_amplification(long long ingested, long long written) {
+        ingested_bytes = ingested;
+        engine_written_bytes = written;
+    }
+
+private:
+    static Metrics* create() {
+        const char* dest = getenv("STORAGE_METRICS");
+        if (dest == nullptr || *dest == '\0') dest = STORAGE_METRICS_DEFAULT;
+        if (dest == nullptr) {
+            return nullptr;
+        }
+        static Metrics instance(dest);
+        return &instance;
+    }
+
+    static Kernel read_kernel() {
+        Kernel k;
+        int fd = ::open("/proc/self/io", O_RDONLY);
+        if (fd < 0) {
+            return k;
+        }
+        char buf[512];
+        ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+        ::close(fd);
+        buf[n > 0 ? n : 0] = '\0';
+        k.probe_bytes = n > 0 ? n : 0;
+        sscanf(buf, "rchar: %lld wchar: %lld syscr: %lld syscw: %lld", &k.rchar, &k.wchar, &k.syscr, &k.syscw);
+        return k;
+    }
+
+    // Charge the time and kernel I/O since the last switch to the current
+    // operation, then make op current
+    void switch_to(Op op) {
+        auto now = std::chrono::steady_clock::now();
+        OpStats& stats = ops[current];
+        stats.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - op_start).count());
+        // The counters read at the start include everything but that read
+        Kernel k = read_kernel();
+        stats.kernel.rchar += k.rchar - kernel_start.rchar - kernel_start.probe_bytes;
+        stats.kernel.wchar += k.wchar - kernel_start.wchar;
+        stats.kernel.syscr += k.syscr - kernel_start.syscr - 1;
+        stats.kernel.syscw += k.syscw - kernel_start.syscw;
+        current = op;
+        kernel_start = k;
+        op_start = std::chrono::steady_clock::now();
+    }
+
+    double amplification() const {
+        return ingested_bytes > 0 ? static_cast<double>(engine_written_bytes) / ingested_bytes : 0;
+    }
+
+    static const char* op_name(int op) {
+        static const char* const NAMES[OP_COUNT] = {"open", "insert", "remove", "find", "flush", "loop"};
+        return NAMES[op];
+    }
+
+    void print_table() const {
+        fprintf(stderr, "%-7s %8s %9s %9s %9s %9s %9s %9s %6s %6s %11s %11s %7s %7s %7s %7s %8s %11s %11s %8s %8s\n",
+                "op", "count", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns", "opens", "seeks",
+                "read", "written", "preads", "pwrites", "blocks", "pages", "syscalls", "k_rchar", "k_wchar",
+                "k_syscr", "k_syscw");
+        for (int i = 0; i < OP_COUNT; i++) {
+            const OpStats& s = ops[i];
+            const Histogram& h = s.latency;
+            fprintf(stderr, "%-7s %8lld %9lld %9lld %9lld %9lld %9lld %9lld %6lld %6lld %11lld %11lld %7lld %7lld %7lld %7lld %8lld %11lld %11lld %8lld %8lld\n",
+                    op_name(i), h.count, h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99),
+                    h.percentile(0.999), h.max(), s.file.opens, s.file.seeks, s.file.bytes_read,
+                    s.file.bytes_written, s.file.reads, s.file.writes, s.file.blocks, s.file.pages,
+                    s.file.syscalls, s.kernel.rchar, s.kernel.wchar, s.kernel.syscr, s.kernel.syscw);
+        }
+        if (ingested_bytes >= 0) {
+            fprintf(stderr, "write amplification: %.2f, %lld bytes written for %lld ingested\n",
+                    amplification(), engine_written_bytes, ingested_bytes);
+        }
+        const Arena& arena = Arena::global();
+        fprintf(stderr, "arena: cap %zu, peak %zu reserved, %zu reserved and %zu in use at exit\n",
+                arena.capacity(), arena.peak_bytes(), arena.reserved_bytes(), arena.used());
+    }
+
+    void write_json() const {
+        FILE* out = fopen(destination.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "cannot write metrics to %s: %s\n", destination.c_str(), strerror(errno));
+            return;
+        }
+        fprintf(out, "{\n");
+        for (int i = 0; i < OP_COUNT; i++) {
+            const OpStats& s = ops[i];
+            const Histogram& h = s.latency;
+            fprintf(out,
+                    "  \"%s\": {\"count\": %lld,\n"
+                    "    \"latency_ns\": {\"mean\": %lld, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, "
+                    "\"p999\": %lld, \"max\": %lld},\n"
+                    "    \"file\": {\"opens\": %lld, \"reads\": %lld, \"writes\": %lld, \"bytes_read\": %lld, "
+                    "\"bytes_written\": %lld, \"seeks\": %lld, \"blocks\": %lld, \"pages\": %lld, "
+                    "\"syscalls\": %lld},\n"
+                    "    \"kernel\": {\"rchar\": %lld, \"wchar\": %lld, \"syscr\": %lld, \"syscw\": %lld}},\n",
+                    op_name(i), h.count, h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99),
+                    h.percentile(0.999), h.max(), s.file.opens, s.file.reads, s.file.writes, s.file.bytes_read,
+                    s.file.bytes_written, s.file.seeks, s.file.blocks, s.file.pages, s.file.syscalls,
+                    s.kernel.rchar, s.kernel.wchar, s.kernel.syscr, s.kernel.syscw);
+        }
+        if (ingested_bytes >= 0) {
+            fprintf(out, "  \"write_amplification\": {\"ratio\": %.4f, \"written\": %lld, \"ingested\": %lld},\n",
+                    amplification(), engine_written_bytes, ingested_bytes);
+        }
+        const Arena& arena = Arena::global();
+        fprintf(out, "  \"arena\": {\"cap\": %zu, \"peak\": %zu, \"reserved\": %zu, \"used\": %zu}\n}\n",
+                arena.capacity(), arena.peak_bytes(), arena.reserved_bytes(), arena.used());
+        fclose(out);
+    }
+};
+
+// StorageEngine that times every call to another one under its Metrics op
+class MeteredEngine : public StorageEngine {
+private:
+    StorageEngine& engine;
+    Metrics& metrics;
+
+public:
+    MeteredEngine(StorageEngine& e, Metrics& m) : engine(e), metrics(m) {
+        metrics.end();  // The engine is open
+    }
+
+    ~MeteredEngine() override {
+        metrics.begin(Metrics::FLUSH);  // Shutdown work counts as flushing
+    }
+
+    void insert(std::string_view key, int value) override {
+        metrics.begin(Metrics::INSERT);
+        engine.insert(key, value);
+        metrics.end();
+    }
+
+    void remove(std::string_view key, int value) override {
+        metrics.begin(Metrics::REMOVE);
+        engine.remove(key, value);
+        metrics.end();
+    }
+
+    std::vector<int> find(std::string_view key) override {
+        metrics.begin(Metrics::FIND);
+        std::vector<int> values = engine.find(key);
+        metrics.end();
+        return values;
+    }
+
+    void find_into(std::string_view key, ValueSink& sink) override {
+        metrics.begin(Metrics::FIND);
+        engine.find_into(key, sink);
+        metrics.end();
+    }
+
+    void flush() override {
+        metrics.begin(Metrics::FLUSH);
+        engine.flush();
+        metrics.end();
+    }
+};
+
+#endif  // METRICS_HPP
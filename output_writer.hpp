@@ -0,0 +1,106 @@
+#ifndef OUTPUT_WRITER_HPP
+#define OUTPUT_WRITER_HPP
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Buffered writer to a file descriptor that bypasses iostreams. Output is
+// formatted straight into one reusable buffer and written with a single
+// write() whenever it fills up, on flush() and on destruction.
+class OutputWriter {
+private:
+    static const size_t BUFFER_BYTES = 64 * 1024;
+    static const size_t MAX_INT_CHARS = 11;  // "-2147483648"
+
+    int fd;
+    std::vector<char> buffer;
+    size_t used;
+
+public:
+    explicit OutputWriter(int output_fd) : fd(output_fd), buffer(BUFFER_BYTES), used(0) {}
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    ~OutputWriter() {
+        flush();
+    }
+
+    void put(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+    }
+
+    void write(std::string_view text) {
+        if (used + text.size() > buffer.size()) {
+            flush();
+            if (text.size() > buffer.size()) {
+                write_fully(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void write_int(int value) {
+        if (used + MAX_INT_CHARS > buffer.size()) flush();
+        char* p = buffer.data() + used;
+
+        unsigned int n = value;
+        if (value < 0) {
+            *p++ = '-';
+            n = 0u - n;
+        }
+
+        // Two digits per step from a table, written back to front
+        static const char DIGIT_PAIRS[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char digits[10];
+        char* d = digits + sizeof(digits);
+        while (n >= 100) {
+            unsigned int pair = (n % 100) * 2;
+            n /= 100;
+            *--d = DIGIT_PAIRS[pair + 1];
+            *--d = DIGIT_PAIRS[pair];
+        }
+        if (n >= 10) {
+            *--d = DIGIT_PAIRS[n * 2 + 1];
+            *--d = DIGIT_PAIRS[n * 2];
+        } else {
+            *--d = '0' + n;
+        }
+
+        size_t len = digits + sizeof(digits) - d;
+        memcpy(p, d, len);
+        used = p + len - buffer.data();
+    }
+
+    void flush() {
+        write_fully(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    void write_fully(const char* data, size_t n) {
+        while (n > 0) {
+            ssize_t put = ::write(fd, data, n);
+            if (put < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("write to output failed: ") + strerror(errno));
+            }
+            data += put;
+            n -= put;
+        }
+    }
+};
+
+#endif  // OUTPUT_WRITER_HPP
@@ -0,0 +1,107 @@
+#ifndef POSTING_LIST_HPP
+#define POSTING_LIST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Ascending, distinct values stored compactly, in frames of at most
+// FrameHeader::MAX_VALUES. A frame is its header followed by the gaps
+// between successive values as varints, 7 bits a byte, low bits first, so
+// a list of close values takes a byte or two per value instead of four.
+//
+// The header carries the frame's first and last values and its size: a
+// search hops from header to header until it reaches the one frame that
+// can hold a value, and only that frame is decoded.
+struct FrameHeader {
+    static const size_t MAX_VALUES = 128;
+
+    int first;
+    int last;
+    uint16_t count;
+    uint16_t bytes;  // of the gaps after the header
+};
+
+// Largest frame of n values
+inline size_t max_frame_bytes(size_t n) {
+    return sizeof(FrameHeader) + (n > 0 ? (n - 1) * 5 : 0);
+}
+
+inline FrameHeader frame_header(const char* frame) {
+    FrameHeader header;
+    memcpy(&header, frame, sizeof(header));
+    return header;
+}
+
+inline size_t frame_size(const char* frame) {
+    return sizeof(FrameHeader) + frame_header(frame).bytes;
+}
+
+// Append a frame of n ascending values, n > 0, to out
+inline void encode_frame(const int* values, size_t n, std::vector<char>& out) {
+    size_t start = out.size();
+    out.resize(start + max_frame_bytes(n));
+    char* p = out.data() + start + sizeof(FrameHeader);
+    for (size_t i = 1; i < n; i++) {
+        uint32_t gap = static_cast<uint32_t>(values[i]) - static_cast<uint32_t>(values[i - 1]);
+        while (gap >= 0x80) {
+            *p++ = static_cast<char>(gap | 0x80);
+            gap >>= 7;
+        }
+        *p++ = static_cast<char>(gap);
+    }
+    FrameHeader header{values[0], values[n - 1], static_cast<uint16_t>(n),
+                       static_cast<uint16_t>(p - (out.data() + start + sizeof(FrameHeader)))};
+    memcpy(out.data() + start, &header, sizeof(header));
+    out.resize(start + sizeof(FrameHeader) + header.bytes);
+}
+
+// Append the values of frame to out
+inline void decode_frame(const char* frame, std::vector<int>& out) {
+    FrameHeader header = frame_header(frame);
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(frame + sizeof(FrameHeader));
+    uint32_t value = static_cast<uint32_t>(header.first);
+    out.push_back(header.first);
+    for (int i = 1; i < header.count; i++) {
+        uint32_t gap = 0;
+        for (int shift = 0;; shift += 7) {
+            gap |= static_cast<uint32_t>(*p & 0x7f) << shift;
+            if (!(*p++ & 0x80)) {
+                break;
+            }
+        }
+        value += gap;
+        out.push_back(static_cast<int>(value));
+    }
+}
+
+// Append n ascending values to out as full frames and a last partial one
+inline void encode_frames(const int* values, size_t n, std::vector<char>& out) {
+    for (size_t i = 0; i < n; i += FrameHeader::MAX_VALUES) {
+        encode_frame(values + i, n - i < FrameHeader::MAX_VALUES ? n - i : FrameHeader::MAX_VALUES, out);
+    }
+}
+
+// Append every value of the frames in frames[0, bytes) to out
+inline void decode_frames(const char* frames, size_t bytes, std::vector<int>& out) {
+    for (size_t at = 0; at < bytes; at += frame_size(frames + at)) {
+        decode_frame(frames + at, out);
+    }
+}
+
+// Offset of the first frame in frames[0, bytes) whose last value is at
+// least value, else of the last frame; bytes if there are none
+inline size_t seek_frame(const char* frames, size_t bytes, int value) {
+    size_t at = 0;
+    while (at < bytes) {
+        size_t size = frame_size(frames + at);
+        if (frame_header(frames + at).last >= value || at + size == bytes) {
+            return at;
+        }
+        at += size;
+    }
+    return bytes;
+}
+
+#endif  // POSTING_LIST_HPP
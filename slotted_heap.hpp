@@ -0,0 +1,841 @@
+#ifndef SLOTTED_HEAP_HPP
+#define SLOTTED_HEAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hpp"
+#include "buffer_pool.hpp"
+#include "entry.hpp"
+#include "posting_list.hpp"
+#include "storage_engine.hpp"
+
+// Keys and their values in one file of fixed-size pages. Page 0 is the
+// meta page; the rest are directory, bucket and heap pages.
+//
+// The directory is an extendible hash table: 2^depth bucket page numbers
+// indexed by the low bits of the key's hash, each bucket packing the
+// [key_len:1][key][page:4][slot:2] entries of its keys. An entry points at
+// the first segment of its key's values.
+//
+// Heap pages are slotted: a slot array grows from the header and records
+// from the end of the page, so a record keeps its (page, slot) address
+// while the page is compacted around it. A key's values, ascending, are a
+// chain of segment records shared out among the heap pages with other
+// keys' segments, each a link to the next and one posting-list frame of up
+// to FrameHeader::MAX_VALUES values. An insert or delete follows the chain
+// by the frames' first and last values, then decodes and rewrites the one
+// segment that can hold its value.
+//
+// A segment that no longer fits its page moves to the page new records go
+// to. Space a delete frees in a page is reused by the page's other records
+// and, once half the page is free, by new ones; a page left with no records
+// goes on a free list and is reused before the file grows.
+//
+// A key whose chain reaches OVERFLOW_SEGMENTS is oversized: the segments
+// split off from then on go to overflow pages that hold only that key's
+// segments, each next to the one it was split from while there is room,
+// so the chain runs in sorted order through a few dedicated pages instead
+// of one page per segment. find_into() streams a chain frame by frame.
+//
+// assign() replaces a key's whole chain at once with full segments, for
+// owners that cache a key's values and write them back in one go.
+//
+// The meta page carries the format version and the key and value counts,
+// so a run that follows a clean one starts from it and the directory. It is
+// marked unclean on disk before the first change of a run and clean again
+// once flush() has written every other page back; a run that finds it
+// unclean recounts the keys and values from the chains.
+class SlottedHeap {
+private:
+    static const int PAGE_SIZE = 4096;
+    static const size_t POOL_BYTES = 64 * PAGE_SIZE;
+    static const uint32_t MAGIC = 0x48454150;  // "HEAP"
+    static const uint32_t VERSION = 1;
+    static const size_t MAX_KEY = 64;
+    static const size_t ROOMY_PAGES = 64;  // half-empty pages remembered for reuse
+    static const size_t OVERFLOW_SEGMENTS = 4;
+
+    struct MetaPage {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t clean;      // 0 from a run's first change until its flush()
+        int depth;           // bits of the hash the directory uses
+        int page_total;
+        int directory_page;  // first of the pages holding the directory
+        int free_page;       // head of the free list, -1 if empty
+        int fill_page;       // heap page new records go to, -1 if none yet
+        uint64_t key_count;
+        uint64_t value_count;
+    };
+
+    static const uint16_t PAGE_FREE = 1;
+    static const uint16_t PAGE_OVERFLOW = 2;  // holds one oversized key's segments
+
+    struct PageHeader {
+        int next;  // next page of the free list
+        uint16_t flags;
+        uint16_t slot_count;
+        uint16_t data_start;  // lowest record offset
+        uint16_t free_bytes;  // unused bytes, gaps between records included
+    };
+
+    struct Slot {
+        uint16_t offset;
+        uint16_t length;  // 0 for an unused slot
+    };
+
+    struct BucketHeader {
+        int depth;  // bits of the hash all keys in the bucket share
+        uint16_t count;
+        uint16_t used;  // bytes of entries
+    };
+
+    static const size_t BUCKET_BYTES = PAGE_SIZE - sizeof(BucketHeader);
+
+    // Address of a record; page -1 for none
+    struct RecordId {
+        int page;
+        uint16_t slot;
+    };
+
+    struct SegmentLink {
+        int next_page;
+        uint16_t next_slot;
+        uint16_t unused;
+    };
+
+    struct Segment {
+        RecordId id;
+        RecordId next;
+        std::vector<int> values;
+    };
+
+    // Where a key's directory entry is
+    struct EntryPos {
+        int bucket;
+        size_t offset;
+    };
+
+    using PageRef = BufferPool::PageRef;
+
+    BufferPool pool;
+    MetaPage meta;
+    std::vector<int> directory;  // bucket page of every hash suffix
+    bool directory_dirty;
+    ArenaVector<int> roomy;  // heap pages with at least half their space free
+
+public:
+    SlottedHeap(const std::string& fname) : pool(fname, PAGE_SIZE, POOL_BYTES), directory_dirty(false) {
+        if (pool.page_count() == 0) {
+            // Fresh file: meta page, a one-entry directory and one bucket,
+            // written out at once
+            meta = {MAGIC, VERSION, 0, 0, 1, 0, -1, -1, 0, 0};
+            meta.directory_page = allocate_page();
+            int bucket = allocate_page();
+            PageRef page = pool.create(bucket);
+            *page.as<BucketHeader>() = {0, 0, 0};
+            pool.create(0);  // Meta page, filled in by save_meta()
+            directory.assign(1, bucket);
+            directory_dirty = true;
+            flush();
+        } else {
+            std::memcpy(&meta, pool.fetch(0).as<MetaPage>(), sizeof(MetaPage));
+            if (meta.magic != MAGIC) {
+                throw std::runtime_error("bad heap file " + fname);
+            }
+            if (meta.version != VERSION) {
+                throw std::runtime_error(fname + " has unsupported format version " +
+                                         std::to_string(meta.version));
+            }
+            load_directory();
+            if (!meta.clean) {
+                recount();
+            }
+        }
+    }
+
+    ~SlottedHeap() {
+        flush();
+    }
+
+    // Write every page back, the meta page last and marked clean
+    void flush() {
+        if (meta.clean) {
+            return;
+        }
+        save_meta();
+        pool.flush();
+        meta.clean = 1;
+        save_meta();
+        pool.write_page(0);
+    }
+
+    uint64_t key_count() const {
+        return meta.key_count;
+    }
+
+    uint64_t value_count() const {
+        return meta.value_count;
+    }
+
+    void insert(std::string_view key, int value) {
+        key = key.substr(0, MAX_KEY);
+        uint64_t hash = hash_of(key);
+        EntryPos pos;
+        if (!find_entry(key, hash, pos)) {
+            begin_change();
+            meta.key_count++;
+            meta.value_count++;
+            Segment segment{{-1, 0}, {-1, 0}, {value}};
+            add_entry(key, hash, place(encode(segment)));
+            return;
+        }
+
+        RecordId prev;
+        Segment segment = read_segment(seek_segment(entry_target(pos), value, prev));
+        auto it = std::lower_bound(segment.values.begin(), segment.values.end(), value);
+        if (it != segment.values.end() && *it == value) {
+            return;
+        }
+        begin_change();
+        meta.value_count++;
+        segment.values.insert(it, value);
+
+        if (segment.values.size() > FrameHeader::MAX_VALUES) {
+            // Split: the upper half becomes a new segment after this one
+            size_t half = segment.values.size() / 2;
+            Segment upper{{-1, 0}, segment.next, {segment.values.begin() + half, segment.values.end()}};
+            segment.values.resize(half);
+            if (is_overflow(segment.id.page) || chain_length(entry_target(pos)) + 1 >= OVERFLOW_SEGMENTS) {
+                segment.next = place_overflow(encode(upper), segment.id.page);
+            } else {
+                segment.next = place(encode(upper));
+            }
+        }
+        store(pos, prev, segment);
+    }
+
+    void remove(std::string_view key, int value) {
+        key = key.substr(0, MAX_KEY);
+        EntryPos pos;
+        if (!find_entry(key, hash_of(key), pos)) {
+            return;
+        }
+
+        RecordId prev;
+        RecordId id = seek_segment(entry_target(pos), value, prev);
+        FrameHeader frame = segment_frame(id);
+        if (value < frame.first || value > frame.last) {
+            return;  // Not in the only segment that could hold it
+        }
+        Segment segment = read_segment(id);
+        auto it = std::lower_bound(segment.values.begin(), segment.values.end(), value);
+        if (it == segment.values.end() || *it != value) {
+            return;
+        }
+        begin_change();
+        meta.value_count--;
+        segment.values.erase(it);
+
+        if (!segment.values.empty()) {
+            store(pos, prev, segment);
+            return;
+        }
+        // Unlink the emptied segment, and the key with its last one
+        release(segment.id);
+        if (prev.page != -1) {
+            set_link(prev, segment.next);
+        } else if (segment.next.page != -1) {
+            set_entry_target(pos, segment.next);
+        } else {
+            meta.key_count--;
+            remove_entry(pos);
+        }
+    }
+
+    // Replace key's values with the n ascending values; with none the key
+    // is dropped
+    void assign(std::string_view key, const int* values, size_t n) {
+        key = key.substr(0, MAX_KEY);
+        uint64_t hash = hash_of(key);
+        EntryPos pos;
+        bool found = find_entry(key, hash, pos);
+        if (!found && n == 0) {
+            return;
+        }
+        begin_change();
+        meta.value_count += n;
+        if (found) {
+            for (RecordId id = entry_target(pos); id.page != -1;) {
+                RecordId next;
+                {
+                    PageRef page = pool.fetch(id.page);
+                    const char* record = page.as<char>() + slots(page.as<char>())[id.slot].offset;
+                    meta.value_count -= frame_header(record + sizeof(SegmentLink)).count;
+                    next = read_link(record);
+                }
+                release(id);
+                id = next;
+            }
+        } else {
+            meta.key_count++;
+        }
+        if (n == 0) {
+            meta.key_count--;
+            remove_entry(pos);
+            return;
+        }
+
+        // Last segment first, so each is placed knowing the one after it
+        size_t count = (n + FrameHeader::MAX_VALUES - 1) / FrameHeader::MAX_VALUES;
+        bool oversized = count >= OVERFLOW_SEGMENTS;
+        Segment segment{{-1, 0}, {-1, 0}, {}};
+        for (size_t i = count; i-- > 0;) {
+            size_t first = i * FrameHeader::MAX_VALUES;
+            segment.values.assign(values + first, values + std::min(n, first + FrameHeader::MAX_VALUES));
+            std::vector<char> bytes = encode(segment);
+            segment.next = oversized ? place_overflow(bytes, segment.next.page) : place(bytes);
+        }
+        if (found) {
+            set_entry_target(pos, segment.next);
+        } else {
+            add_entry(key, hash, segment.next);
+        }
+    }
+
+    // Number of key's values, read from its frame headers alone
+    size_t count(std::string_view key) {
+        key = key.substr(0, MAX_KEY);
+        EntryPos pos;
+        if (!find_entry(key, hash_of(key), pos)) {
+            return 0;
+        }
+        return chain_values(entry_target(pos));
+    }
+
+    std::vector<int> find(std::string_view key) {
+        ValueCollector values;
+        find_into(key, values);
+        return std::move(values.values);
+    }
+
+    // Pass key's values to sink a segment at a time
+    void find_into(std::string_view key, ValueSink& sink) {
+        key = key.substr(0, MAX_KEY);
+        EntryPos pos;
+        if (!find_entry(key, hash_of(key), pos)) {
+            return;
+        }
+        std::vector<int> values;
+        for (RecordId id = entry_target(pos); id.page != -1;) {
+            {
+                PageRef page = pool.fetch(id.page);
+                const char* record = page.as<char>() + slots(page.as<char>())[id.slot].offset;
+                values.clear();
+                decode_frame(record + sizeof(SegmentLink), values);
+                id = read_link(record);
+            }
+            sink.put(values.data(), values.size());
+        }
+    }
+
+private:
+    static uint64_t hash_of(std::string_view key) {
+        return Entry::hash_key(key.data(), key.size());
+    }
+
+    int allocate_page() {
+        return meta.page_total++;
+    }
+
+    // Mark the file unclean on disk before the first change of a run
+    void begin_change() {
+        if (meta.clean) {
+            meta.clean = 0;
+            save_meta();
+            pool.write_page(0);
+        }
+    }
+
+    // Count the keys and values again after a run that did not finish
+    void recount() {
+        meta.key_count = 0;
+        meta.value_count = 0;
+        std::vector<int> buckets(directory);
+        std::sort(buckets.begin(), buckets.end());
+        buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+        for (int bucket : buckets) {
+            PageRef page = pool.fetch(bucket);
+            const BucketHeader* header = page.as<BucketHeader>();
+            const char* entries = page.as<char>() + sizeof(BucketHeader);
+            meta.key_count += header->count;
+            for (size_t offset = 0; offset < header->used; offset += entry_bytes(uint8_t(entries[offset]))) {
+                meta.value_count += chain_values(entry_target({bucket, offset}));
+            }
+        }
+    }
+
+    // ---- Meta page and directory ----
+
+    static int directory_pages(int depth) {
+        size_t bytes = (size_t(1) << depth) * sizeof(int);
+        return (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
+
+    int bucket_of(uint64_t hash) const {
+        return directory[hash & ((1ULL << meta.depth) - 1)];
+    }
+
+    void load_directory() {
+        directory.resize(size_t(1) << meta.depth);
+        size_t bytes = directory.size() * sizeof(int);
+        for (int i = 0; i < directory_pages(meta.depth); i++) {
+            size_t n = std::min<size_t>(PAGE_SIZE, bytes - i * PAGE_SIZE);
+            std::memcpy(reinterpret_cast<char*>(directory.data()) + i * PAGE_SIZE,
+                        pool.fetch(meta.directory_page + i).as<char>(), n);
+        }
+    }
+
+    void save_meta() {
+        if (directory_dirty) {
+            size_t bytes = directory.size() * sizeof(int);
+            for (int i = 0; i < directory_pages(meta.depth); i++) {
+                size_t n = std::min<size_t>(PAGE_SIZE, bytes - i * PAGE_SIZE);
+                std::memcpy(pool.create(meta.directory_page + i).as<char>(),
+                            reinterpret_cast<const char*>(directory.data()) + i * PAGE_SIZE, n);
+            }
+            directory_dirty = false;
+        }
+        PageRef page = pool.fetch(0);
+        std::memcpy(page.as<MetaPage>(), &meta, sizeof(MetaPage));
+        page.mark_dirty();
+    }
+
+    // ---- Bucket entries ----
+
+    static size_t entry_bytes(size_t key_len) {
+        return 1 + key_len + sizeof(int) + sizeof(uint16_t);
+    }
+
+    bool find_entry(std::string_view key, uint64_t hash, EntryPos& pos) {
+        int id = bucket_of(hash);
+        PageRef page = pool.fetch(id);
+        const BucketHeader* header = page.as<BucketHeader>();
+        const char* entries = page.as<char>() + sizeof(BucketHeader);
+        for (size_t offset = 0; offset < header->used; offset += entry_bytes(uint8_t(entries[offset]))) {
+            if (std::string_view(entries + offset + 1, uint8_t(entries[offset])) == key) {
+                pos = {id, offset};
+                return true;
+            }
+        }
+        return false;
+    }
+
+    RecordId entry_target(const EntryPos& pos) {
+        PageRef page = pool.fetch(pos.bucket);
+        const char* entry = page.as<char>() + sizeof(BucketHeader) + pos.offset;
+        const char* p = entry + 1 + uint8_t(entry[0]);
+        RecordId id;
+        std::memcpy(&id.page, p, sizeof(int));
+        std::memcpy(&id.slot, p + sizeof(int), sizeof(uint16_t));
+        return id;
+    }
+
+    void set_entry_target(const EntryPos& pos, RecordId id) {
+        PageRef page = pool.fetch(pos.bucket);
+        char* entry = page.as<char>() + sizeof(BucketHeader) + pos.offset;
+        char* p = entry + 1 + uint8_t(entry[0]);
+        std::memcpy(p, &id.page, sizeof(int));
+        std::memcpy(p + sizeof(int), &id.slot, sizeof(uint16_t));
+        page.mark_dirty();
+    }
+
+    void add_entry(std::string_view key, uint64_t hash, RecordId id) {
+        size_t bytes = entry_bytes(key.size());
+        for (;;) {
+            int bucket = bucket_of(hash);
+            PageRef page = pool.fetch(bucket);
+            BucketHeader* header = page.as<BucketHeader>();
+            if (header->used + bytes <= BUCKET_BYTES) {
+                char* entry = page.as<char>() + sizeof(BucketHeader) + header->used;
+                entry[0] = static_cast<char>(key.size());
+                std::memcpy(entry + 1, key.data(), key.size());
+                header->used += bytes;
+                header->count++;
+                page.mark_dirty();
+                set_entry_target({bucket, static_cast<size_t>(entry - page.as<char>() - sizeof(BucketHeader))}, id);
+                return;
+            }
+            split(bucket, page);
+        }
+    }
+
+    void remove_entry(const EntryPos& pos) {
+        PageRef page = pool.fetch(pos.bucket);
+        BucketHeader* header = page.as<BucketHeader>();
+        char* entries = page.as<char>() + sizeof(BucketHeader);
+        size_t bytes = entry_bytes(uint8_t(entries[pos.offset]));
+        std::memmove(entries + pos.offset, entries + pos.offset + bytes, header->used - pos.offset - bytes);
+        header->used -= bytes;
+        header->count--;
+        page.mark_dirty();
+    }
+
+    // Move the entries of a full bucket whose next hash bit is set to a new
+    // bucket, doubling the directory first if the bucket uses every bit
+    void split(int id, PageRef& page) {
+        BucketHeader* header = page.as<BucketHeader>();
+        int depth = header->depth;
+        if (depth == meta.depth) {
+            int old_page = meta.directory_page;
+            int old_pages = directory_pages(meta.depth);
+            size_t size = directory.size();
+            directory.resize(size * 2);
+            std::copy(directory.begin(), directory.begin() + size, directory.begin() + size);
+            meta.depth++;
+            meta.directory_page = allocate_pages(directory_pages(meta.depth));
+            for (int i = 0; i < old_pages; i++) {
+                free_page(old_page + i);
+            }
+        }
+
+        int sibling_id = allocate_page();
+        PageRef sibling_page = pool.create(sibling_id);
+        BucketHeader* sibling = sibling_page.as<BucketHeader>();
+        *sibling = {depth + 1, 0, 0};
+        header->depth = depth + 1;
+
+        uint64_t bit = 1ULL << depth;
+        char* entries = page.as<char>() + sizeof(BucketHeader);
+        char* moved = sibling_page.as<char>() + sizeof(BucketHeader);
+        size_t kept = 0;
+        int kept_count = 0;
+        for (size_t offset = 0; offset < header->used;) {
+            uint8_t key_len = entries[offset];
+            size_t bytes = entry_bytes(key_len);
+            if (hash_of(std::string_view(entries + offset + 1, key_len)) & bit) {
+                std::memcpy(moved + sibling->used, entries + offset, bytes);
+                sibling->used += bytes;
+                sibling->count++;
+            } else {
+                std::memmove(entries + kept, entries + offset, bytes);
+                kept += bytes;
+                kept_count++;
+            }
+            offset += bytes;
+        }
+        header->used = kept;
+        header->count = kept_count;
+        page.mark_dirty();
+
+        for (size_t i = 0; i < directory.size(); i++) {
+            if (directory[i] == id && (i & bit)) {
+                directory[i] = sibling_id;
+            }
+        }
+        directory_dirty = true;
+    }
+
+    int allocate_pages(int n) {
+        int first = meta.page_total;
+        meta.page_total += n;
+        return first;
+    }
+
+    // ---- Slotted heap pages ----
+
+    static PageHeader* header(char* page) {
+        return reinterpret_cast<PageHeader*>(page);
+    }
+
+    static Slot* slots(char* page) {
+        return reinterpret_cast<Slot*>(page + sizeof(PageHeader));
+    }
+
+    static void init_heap_page(char* page) {
+        *header(page) = {-1, 0, 0, PAGE_SIZE, PAGE_SIZE - sizeof(PageHeader)};
+    }
+
+    static size_t contiguous_bytes(char* page) {
+        return header(page)->data_start - sizeof(PageHeader) - header(page)->slot_count * sizeof(Slot);
+    }
+
+    static int unused_slot(char* page) {
+        for (int i = 0; i < header(page)->slot_count; i++) {
+            if (slots(page)[i].length == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    static bool has_room(char* page, size_t bytes) {
+        size_t need = bytes + (unused_slot(page) == -1 ? sizeof(Slot) : 0);
+        return header(page)->free_bytes >= need;
+    }
+
+    // Move the records to the end of the page, closing the gaps between them
+    static void compact(char* page) {
+        char copy[PAGE_SIZE];
+        std::memcpy(copy, page, PAGE_SIZE);
+        uint16_t end = PAGE_SIZE;
+        for (int i = 0; i < header(page)->slot_count; i++) {
+            Slot& slot = slots(page)[i];
+            if (slot.length != 0) {
+                end -= slot.length;
+                std::memcpy(page + end, copy + slot.offset, slot.length);
+                slot.offset = end;
+            }
+        }
+        header(page)->data_start = end;
+    }
+
+    // Copy bytes into slot, which is unused; the page has room for them
+    static void put_record(char* page, int slot, const std::vector<char>& bytes) {
+        if (contiguous_bytes(page) < bytes.size()) {
+            compact(page);
+        }
+        header(page)->data_start -= bytes.size();
+        header(page)->free_bytes -= bytes.size();
+        std::memcpy(page + header(page)->data_start, bytes.data(), bytes.size());
+        slots(page)[slot] = {header(page)->data_start, static_cast<uint16_t>(bytes.size())};
+    }
+
+    static int add_record(char* page, const std::vector<char>& bytes) {
+        int slot = unused_slot(page);
+        if (slot == -1) {
+            // The slot array grows into the free space too
+            if (contiguous_bytes(page) < sizeof(Slot) + bytes.size()) {
+                compact(page);
+            }
+            slot = header(page)->slot_count++;
+            header(page)->free_bytes -= sizeof(Slot);
+            slots(page)[slot] = {0, 0};
+        }
+        put_record(page, slot, bytes);
+        return slot;
+    }
+
+    static void drop_record(char* page, int slot) {
+        header(page)->free_bytes += slots(page)[slot].length;
+        slots(page)[slot] = {0, 0};
+        while (header(page)->slot_count > 0 && slots(page)[header(page)->slot_count - 1].length == 0) {
+            header(page)->slot_count--;
+            header(page)->free_bytes += sizeof(Slot);
+        }
+    }
+
+    // Replace the record in slot, keeping its address; false if the page
+    // has no room for the new one
+    static bool replace_record(char* page, int slot, const std::vector<char>& bytes) {
+        Slot& old = slots(page)[slot];
+        if (bytes.size() <= old.length) {
+            std::memcpy(page + old.offset, bytes.data(), bytes.size());
+            header(page)->free_bytes += old.length - bytes.size();
+            old.length = bytes.size();
+            return true;
+        }
+        if (header(page)->free_bytes + old.length < bytes.size()) {
+            return false;
+        }
+        header(page)->free_bytes += old.length;
+        old = {0, 0};
+        put_record(page, slot, bytes);
+        return true;
+    }
+
+    // ---- Segments ----
+
+    static std::vector<char> encode(const Segment& segment) {
+        SegmentLink link{segment.next.page, segment.next.slot, 0};
+        std::vector<char> bytes(reinterpret_cast<const char*>(&link), reinterpret_cast<const char*>(&link + 1));
+        encode_frame(segment.values.data(), segment.values.size(), bytes);
+        return bytes;
+    }
+
+    static RecordId read_link(const char* record) {
+        SegmentLink link;
+        std::memcpy(&link, record, sizeof(link));
+        return {link.next_page, link.next_slot};
+    }
+
+    FrameHeader segment_frame(RecordId id) {
+        PageRef page = pool.fetch(id.page);
+        return frame_header(page.as<char>() + slots(page.as<char>())[id.slot].offset + sizeof(SegmentLink));
+    }
+
+    // The first segment from id on whose frame reaches value, or the last
+    // one; prev is the segment before it, page -1 if it is the first
+    RecordId seek_segment(RecordId id, int value, RecordId& prev) {
+        prev = {-1, 0};
+        for (;;) {
+            PageRef page = pool.fetch(id.page);
+            const char* record = page.as<char>() + slots(page.as<char>())[id.slot].offset;
+            RecordId next = read_link(record);
+            if (next.page == -1 || frame_header(record + sizeof(SegmentLink)).last >= value) {
+                return id;
+            }
+            prev = id;
+            id = next;
+        }
+    }
+
+    Segment read_segment(RecordId id) {
+        PageRef page = pool.fetch(id.page);
+        const char* record = page.as<char>() + slots(page.as<char>())[id.slot].offset;
+        Segment segment{id, read_link(record), {}};
+        decode_frame(record + sizeof(SegmentLink), segment.values);
+        return segment;
+    }
+
+    // Point the segment at id to next; its size does not change
+    void set_link(RecordId id, RecordId next) {
+        PageRef page = pool.fetch(id.page);
+        SegmentLink link{next.page, next.slot, 0};
+        std::memcpy(page.as<char>() + slots(page.as<char>())[id.slot].offset, &link, sizeof(link));
+        page.mark_dirty();
+    }
+
+    // Write segment back, moving it if its page is too full and pointing
+    // prev, or the key's entry at pos if it is the first, at its new place
+    void store(const EntryPos& pos, RecordId prev, const Segment& segment) {
+        std::vector<char> bytes = encode(segment);
+        {
+            PageRef page = pool.fetch(segment.id.page);
+            bool replaced = replace_record(page.as<char>(), segment.id.slot, bytes);
+            page.mark_dirty();
+            if (replaced) {
+                return;
+            }
+        }
+        RecordId moved = is_overflow(segment.id.page) ? place_overflow(bytes, prev.page) : place(bytes);
+        release(segment.id);
+        if (prev.page == -1) {
+            set_entry_target(pos, moved);
+        } else {
+            set_link(prev, moved);
+        }
+    }
+
+    // Put a new record in the fill page, starting a new one if it is full
+    RecordId place(const std::vector<char>& bytes) {
+        for (;;) {
+            if (meta.fill_page != -1) {
+                PageRef page = pool.fetch(meta.fill_page);
+                if (has_room(page.as<char>(), bytes.size())) {
+                    int slot = add_record(page.as<char>(), bytes);
+                    page.mark_dirty();
+                    return {meta.fill_page, static_cast<uint16_t>(slot)};
+                }
+            }
+            meta.fill_page = next_fill_page();
+        }
+    }
+
+    // A remembered half-empty page, else an empty one
+    int next_fill_page() {
+        while (!roomy.empty()) {
+            int id = roomy.back();
+            roomy.pop_back();
+            PageRef page = pool.fetch(id);
+            const PageHeader* h = header(page.as<char>());
+            if (id != meta.fill_page && !(h->flags & (PAGE_FREE | PAGE_OVERFLOW)) &&
+                h->free_bytes >= PAGE_SIZE / 2) {
+                return id;
+            }
+        }
+        return empty_page();
+    }
+
+    // Put a segment of an oversized key in the overflow page near, or a
+    // new overflow page if near is not one or has no room
+    RecordId place_overflow(const std::vector<char>& bytes, int near) {
+        if (near != -1 && is_overflow(near)) {
+            PageRef page = pool.fetch(near);
+            if (has_room(page.as<char>(), bytes.size())) {
+                int slot = add_record(page.as<char>(), bytes);
+                page.mark_dirty();
+                return {near, static_cast<uint16_t>(slot)};
+            }
+        }
+        int id = empty_page();
+        PageRef page = pool.fetch(id);
+        header(page.as<char>())->flags = PAGE_OVERFLOW;
+        int slot = add_record(page.as<char>(), bytes);
+        page.mark_dirty();
+        return {id, static_cast<uint16_t>(slot)};
+    }
+
+    bool is_overflow(int id) {
+        return header(pool.fetch(id).as<char>())->flags & PAGE_OVERFLOW;
+    }
+
+    size_t chain_length(RecordId id) {
+        size_t n = 0;
+        for (; id.page != -1; n++) {
+            PageRef page = pool.fetch(id.page);
+            id = read_link(page.as<char>() + slots(page.as<char>())[id.slot].offset);
+        }
+        return n;
+    }
+
+    // Values in the chain from id on, by its frame headers
+    uint64_t chain_values(RecordId id) {
+        uint64_t n = 0;
+        while (id.page != -1) {
+            PageRef page = pool.fetch(id.page);
+            const char* record = page.as<char>() + slots(page.as<char>())[id.slot].offset;
+            n += frame_header(record + sizeof(SegmentLink)).count;
+            id = read_link(record);
+        }
+        return n;
+    }
+
+    // A heap page with no records, from the free list or the end of the file
+    int empty_page() {
+        int id;
+        if (meta.free_page != -1) {
+            id = meta.free_page;
+            meta.free_page = header(pool.fetch(id).as<char>())->next;
+        } else {
+            id = allocate_page();
+        }
+        init_heap_page(pool.create(id).as<char>());
+        return id;
+    }
+
+    void release(RecordId id) {
+        PageRef page = pool.fetch(id.page);
+        char* p = page.as<char>();
+        drop_record(p, id.slot);
+        page.mark_dirty();
+        if (id.page == meta.fill_page) {
+            return;
+        }
+        if (header(p)->slot_count == 0) {
+            header(p)->flags |= PAGE_FREE;
+            header(p)->next = meta.free_page;
+            meta.free_page = id.page;
+        } else if (!(header(p)->flags & PAGE_OVERFLOW) && header(p)->free_bytes >= PAGE_SIZE / 2 &&
+                   roomy.size() < ROOMY_PAGES) {
+            roomy.push_back(id.page);
+        }
+    }
+
+    // Put a page that is no longer used on the free list
+    void free_page(int id) {
+        PageRef page = pool.create(id);
+        init_heap_page(page.as<char>());
+        header(page.as<char>())->flags = PAGE_FREE;
+        header(page.as<char>())->next = meta.free_page;
+        meta.free_page = id;
+    }
+};
+
+#endif  // SLOTTED_HEAP_HPP
@@ -0,0 +1,55 @@
+#ifndef STORAGE_ENGINE_HPP
+#define STORAGE_ENGINE_HPP
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Takes the values of a find, ascending, a run at a time as storage reads
+// them, so a key with a huge value set need not be collected first
+class ValueSink {
+public:
+    virtual void put(const int* values, size_t n) = 0;
+
+protected:
+    ~ValueSink() = default;
+};
+
+// Sink that collects the values, for find() on top of a streaming walk
+class ValueCollector : public ValueSink {
+public:
+    std::vector<int> values;
+
+    void put(const int* v, size_t n) override {
+        values.insert(values.end(), v, v + n);
+    }
+};
+
+// What the command loop needs from a storage backend: a persistent
+// multimap from keys to int values.
+class StorageEngine {
+public:
+    virtual ~StorageEngine() = default;
+
+    // Add the pair; a pair that is already stored is left as it is
+    virtual void insert(std::string_view key, int value) = 0;
+
+    // Remove the pair if it is stored
+    virtual void remove(std::string_view key, int value) = 0;
+
+    // Values stored under key, in ascending order
+    virtual std::vector<int> find(std::string_view key) = 0;
+
+    // Pass the values stored under key to sink in ascending order. Backends
+    // that keep a key's values in order override it to stream them as they
+    // are read.
+    virtual void find_into(std::string_view key, ValueSink& sink) {
+        std::vector<int> values = find(key);
+        sink.put(values.data(), values.size());
+    }
+
+    // Make every change so far durable in the backend's files
+    virtual void flush() = 0;
+};
+
+#endif  // STORAGE_ENGINE_HPP
@@ -0,0 +1,70 @@
+#ifndef SUPERBLOCK_HPP
+#define SUPERBLOCK_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "file_io.hpp"
+
+// Fixed block at the head of a data file that describes the rest of it, so
+// a run can start from this one read instead of reparsing the file. A
+// format keeps whatever it needs to find its data in directory,
+// directory_bytes and space_end, and says what they mean.
+//
+// clean is 1 while the file is consistent on disk. A writer that updates
+// the file in place clears it before its first change and sets it again
+// once everything is written back, so a reader that finds it 0 knows the
+// last run stopped halfway and must recover.
+struct Superblock {
+    static const uint32_t VERSION = 1;
+    static const size_t BYTES = 64;
+
+    uint32_t magic;  // of the file's format
+    uint32_t version;
+    uint32_t clean;
+    uint32_t checksum;  // of the superblock with this field zero
+    uint64_t key_count;
+    uint64_t value_count;
+    uint64_t directory;  // where the format's directory or root is
+    uint64_t directory_bytes;
+    uint64_t space_end;  // bytes or pages in use
+    uint64_t reserved;
+
+    explicit Superblock(uint32_t file_magic = 0)
+        : magic(file_magic), version(VERSION), clean(1), checksum(0), key_count(0), value_count(0),
+          directory(0), directory_bytes(0), space_end(0), reserved(0) {}
+
+    // Read the superblock of file; false if the file is empty. Throws if it
+    // is not a file of this magic and version.
+    bool read(RandomAccessFile& file, uint32_t file_magic) {
+        if (file.size() == 0) {
+            return false;
+        }
+        if (file.read_at(0, this, sizeof(Superblock)) != sizeof(Superblock) || magic != file_magic ||
+            checksum != compute_checksum()) {
+            throw std::runtime_error("bad superblock in " + file.name());
+        }
+        if (version != VERSION) {
+            throw std::runtime_error(file.name() + " has unsupported format version " +
+                                     std::to_string(version));
+        }
+        return true;
+    }
+
+    void write(RandomAccessFile& file) {
+        checksum = compute_checksum();
+        file.write_at(0, this, sizeof(Superblock));
+    }
+
+private:
+    uint32_t compute_checksum() const {
+        Superblock copy = *this;
+        copy.checksum = 0;
+        return static_cast<uint32_t>(::checksum(&copy, sizeof(copy)));
+    }
+};
+
+static_assert(sizeof(Superblock) == Superblock::BYTES, "superblock layout");
+
+#endif  // SUPERBLOCK_HPP
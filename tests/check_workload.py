@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""
+Run one storage variant on a generated workload and check its output.
+
+The runs of the workload go to the binary in order, in one fresh working
+directory, each with the extra arguments given after the binary. The check
+fails on the first run that exits non-zero or prints anything but the
+model's answer. CMake registers one CTest test per variant and workload.
+
+Usage:
+    python3 tests/check_workload.py --kind reinsert --ops 2000 build/code_log --window=1
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(REPO, "bench"))
+import gen_workload  # noqa: E402
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check a storage variant on a workload")
+    parser.add_argument("--kind", choices=sorted(gen_workload.KINDS), required=True)
+    parser.add_argument("--ops", type=int, default=2000)
+    parser.add_argument("--keys", type=int, default=2000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("binary")
+    parser.add_argument("args", nargs=argparse.REMAINDER, help="passed to the binary")
+    args = parser.parse_args()
+
+    runs = gen_workload.generate(args.kind, args.ops, args.keys, args.seed)
+    work_dir = tempfile.mkdtemp(prefix="check_")
+    try:
+        for i, (text, answer) in enumerate(runs, 1):
+            proc = subprocess.run([os.path.abspath(args.binary)] + args.args, input=text.encode(),
+                                  cwd=work_dir, capture_output=True)
+            if proc.returncode != 0:
+                sys.exit(f"run {i}: exit {proc.returncode}: {proc.stderr.decode().strip()}")
+            output = proc.stdout.decode()
+            if output != answer:
+                got, want = output.splitlines(), answer.splitlines()
+                line = next((n for n, (a, b) in enumerate(zip(got, want)) if a != b), min(len(got), len(want)))
+                sys.exit(f"run {i}: output differs at find {line + 1} of {len(want)}")
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "entry.hpp"
+#include "file_io.hpp"
+
+// Append-only write-ahead log of insert/delete operations. Records are
+// buffered in memory and written in groups, either when the buffer reaches
+// group_bytes or on an explicit flush(), each group synced before flush()
+// returns. Once the operations have reached the storage engine's own files
+// the log is reset(); whatever is left in it at startup belongs to a run
+// that never got that far and is replayed.
+//
+// Each record carries a checksum. Replay stops at the first record that is
+// torn, fails its checksum or has an unknown op, since nothing after it can
+// be trusted to follow the operations before; appends then overwrite it.
+class WriteAheadLog {
+public:
+    enum Op { INSERT = 1, REMOVE = 2 };
+
+    struct Record {
+        uint32_t op;
+        uint32_t checksum;  // of the record with this field zero
+        Entry entry;
+    };
+
+private:
+    RandomAccessFile file;
+    std::vector<Record> buffer;
+    size_t group_records;
+    long long logged_bytes;  // bytes in the log file since the last reset
+
+public:
+    WriteAheadLog(const std::string& fname, size_t group_bytes)
+        : file(fname), group_records(group_bytes / sizeof(Record)), logged_bytes(0) {
+        if (group_records == 0) group_records = 1;
+        buffer.reserve(group_records);
+
+        // A torn record at the tail is ignored by replay and overwritten
+        logged_bytes = file.size() / sizeof(Record) * sizeof(Record);
+    }
+
+    ~WriteAheadLog() {
+        flush();
+    }
+
+    void append(Op op, std::string_view key, int value) {
+        Record record{static_cast<uint32_t>(op), 0, Entry(key, value)};
+        record.checksum = record_checksum(record);
+        buffer.push_back(record);
+        if (buffer.size() >= group_records) {
+            flush();
+        }
+    }
+
+    // Group commit: write every buffered record with a single write and
+    // sync it
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        size_t bytes = buffer.size() * sizeof(Record);
+        file.write_at(logged_bytes, buffer.data(), bytes);
+        file.sync_data();
+        logged_bytes += bytes;
+        buffer.clear();
+    }
+
+    // Call fn(op, entry) for every record in the log file up to the first
+    // bad one, which with the rest is dropped
+    template <class Fn>
+    void replay(Fn fn) {
+        Record chunk[64];
+        long long offset = 0;
+        while (offset < logged_bytes) {
+            size_t got = file.read_at(offset, chunk, sizeof(chunk));
+            size_t records = got / sizeof(Record);
+            size_t good = 0;
+            while (good < records && valid(chunk[good])) {
+                fn(static_cast<Op>(chunk[good].op), chunk[good].entry);
+                good++;
+            }
+            offset += good * sizeof(Record);
+            if (records == 0 || good < records) break;
+        }
+        logged_bytes = offset;
+    }
+
+    // Drop every logged record; the caller has made them durable elsewhere
+    void reset() {
+        buffer.clear();
+        file.truncate(0);
+        logged_bytes = 0;
+    }
+
+    long long size() const {
+        return logged_bytes;
+    }
+
+private:
+    static uint32_t record_checksum(Record record) {
+        record.checksum = 0;
+        return static_cast<uint32_t>(checksum(&record, sizeof(record)));
+    }
+
+    static bool valid(const Record& record) {
+        return (record.op == INSERT || record.op == REMOVE) && record.checksum == record_checksum(record);
+    }
+};
+
+#endif  // WAL_HPP